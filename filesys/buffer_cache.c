@@ -0,0 +1,294 @@
+/* buffer_cache.c: Cache of file system disk sectors.
+ *
+ * Every sector of the file system disk is read and written through a
+ * fixed set of BUFFER_CACHE_SIZE buffers, so that inodes, directories,
+ * the free map and the FAT are not read again on every access, and a
+ * partial write does not read the sector each time.  Buffers are
+ * replaced by the clock algorithm.  Writes only dirty a buffer; dirty
+ * buffers are written back when they are replaced, by bcflushd once
+ * they have been dirty for FLUSH_AGE, by buffer_cache_flush() when the
+ * file system is shut down, and by buffer_cache_flush_sector() when
+ * msync() asks for file data to reach the disk.
+ *
+ * Metadata is written with buffer_cache_write_meta() instead, which
+ * leaves the buffer clean and puts the sector into the journal, which
+ * writes it in place once it is committed (filesys/journal.c). */
+
+#include "filesys/buffer_cache.h"
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors cached. */
+#define BUFFER_CACHE_SIZE 64
+/* How often bcflushd wakes up, and how long a buffer may stay dirty. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+#define FLUSH_AGE (30 * TIMER_FREQ)
+
+/* Sector of a buffer that holds none. */
+#define NO_SECTOR UINT32_MAX
+
+/* A cached sector. */
+struct buffer {
+	disk_sector_t sector;        /* Sector held, or NO_SECTOR. */
+	bool valid;                  /* DATA holds SECTOR's contents? */
+	bool dirty;                  /* DATA must be written back? */
+	bool accessed;               /* Used since the clock hand passed? */
+	int64_t dirty_since;         /* Ticks when DIRTY was set. */
+	struct lock lock;            /* Held while DATA is used and whenever
+	                                SECTOR changes. */
+	uint8_t *data;               /* DISK_SECTOR_SIZE bytes. */
+};
+
+static struct buffer buffers[BUFFER_CACHE_SIZE];
+static size_t clock_hand;
+
+/* Protects the assignment of sectors to buffers and CLOCK_HAND.
+ * Never held while waiting for the lock of a buffer, which may be held
+ * across a disk write; only lock_try_acquire() is used on one then. */
+static struct lock buffer_cache_lock;
+
+static void bcflushd (void *aux UNUSED);
+
+/* Initializes the buffer cache. */
+void
+buffer_cache_init (void) {
+	uint8_t *data = palloc_get_multiple (PAL_ASSERT,
+			BUFFER_CACHE_SIZE * DISK_SECTOR_SIZE / PGSIZE);
+
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct buffer *b = &buffers[i];
+
+		b->sector = NO_SECTOR;
+		b->valid = b->dirty = b->accessed = false;
+		lock_init (&b->lock);
+		b->data = data + i * DISK_SECTOR_SIZE;
+	}
+	clock_hand = 0;
+	lock_init (&buffer_cache_lock);
+	thread_create ("bcflushd", PRI_DEFAULT, bcflushd, NULL);
+}
+
+/* Writes B back to the disk if it is dirty.  Requires B's lock. */
+static void
+buffer_write_back (struct buffer *b) {
+	if (b->dirty) {
+		disk_write (filesys_disk, b->sector, b->data);
+		b->dirty = false;
+	}
+}
+
+/* Returns the buffer assigned to SECTOR, or a null pointer if there is
+ * none.  Requires buffer_cache_lock. */
+static struct buffer *
+buffer_find (disk_sector_t sector) {
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++)
+		if (buffers[i].sector == sector)
+			return &buffers[i];
+	return NULL;
+}
+
+/* Picks a buffer not used recently by the clock algorithm and returns
+ * it, locked.  It may still be dirty.  Requires buffer_cache_lock. */
+static struct buffer *
+buffer_evict (void) {
+	for (;;) {
+		struct buffer *b = &buffers[clock_hand];
+
+		clock_hand = (clock_hand + 1) % BUFFER_CACHE_SIZE;
+		if (!lock_try_acquire (&b->lock))
+			continue;
+		if (b->accessed) {
+			b->accessed = false;
+			lock_release (&b->lock);
+			continue;
+		}
+		return b;
+	}
+}
+
+/* Returns the buffer for SECTOR, locked, replacing another one if
+ * SECTOR is not cached.  Reads SECTOR into it unless it already holds
+ * it or FILL is false, in which case the caller overwrites all of
+ * it. */
+static struct buffer *
+buffer_get (disk_sector_t sector, bool fill) {
+	struct buffer *b;
+
+	for (;;) {
+		lock_acquire (&buffer_cache_lock);
+		b = buffer_find (sector);
+		if (b == NULL) {
+			b = buffer_evict ();
+			if (b->dirty) {
+				/* Write the victim back with only its own lock held,
+				 * which keeps it from being used or picked again, and
+				 * then check that no one cached SECTOR meanwhile. */
+				lock_release (&buffer_cache_lock);
+				buffer_write_back (b);
+				lock_acquire (&buffer_cache_lock);
+				if (buffer_find (sector) != NULL) {
+					lock_release (&buffer_cache_lock);
+					lock_release (&b->lock);
+					continue;
+				}
+			}
+			b->sector = sector;
+			b->valid = false;
+			lock_release (&buffer_cache_lock);
+			break;
+		}
+		lock_release (&buffer_cache_lock);
+
+		/* B may be replaced before we get it. */
+		lock_acquire (&b->lock);
+		if (b->sector == sector)
+			break;
+		lock_release (&b->lock);
+	}
+
+	if (fill && !b->valid) {
+		if (!journal_read (sector, b->data))
+			disk_read (filesys_disk, sector, b->data);
+		b->valid = true;
+	}
+	b->accessed = true;
+	return b;
+}
+
+/* Reads SIZE bytes at SECTOR_OFS within SECTOR into BUFFER.  The
+ * bytes may run on into the sectors that follow SECTOR, so that a
+ * cluster is read in one call. */
+void
+buffer_cache_read (disk_sector_t sector, void *buffer_, int sector_ofs,
+		int size) {
+	uint8_t *buffer = buffer_;
+
+	ASSERT (sector_ofs >= 0 && size >= 0);
+
+	sector += sector_ofs / DISK_SECTOR_SIZE;
+	sector_ofs %= DISK_SECTOR_SIZE;
+	while (size > 0) {
+		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+		int chunk_size = size < sector_left ? size : sector_left;
+		struct buffer *b = buffer_get (sector, true);
+
+		memcpy (buffer, b->data + sector_ofs, chunk_size);
+		lock_release (&b->lock);
+
+		sector++;
+		sector_ofs = 0;
+		buffer += chunk_size;
+		size -= chunk_size;
+	}
+}
+
+/* Writes SIZE bytes from BUFFER at SECTOR_OFS within SECTOR, as
+ * buffer_cache_write() and buffer_cache_write_meta() do, through the
+ * journal if META is true. */
+static void
+buffer_write (disk_sector_t sector, const uint8_t *buffer, int sector_ofs,
+		int size, bool meta) {
+	ASSERT (sector_ofs >= 0 && size >= 0);
+
+	sector += sector_ofs / DISK_SECTOR_SIZE;
+	sector_ofs %= DISK_SECTOR_SIZE;
+	while (size > 0) {
+		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+		int chunk_size = size < sector_left ? size : sector_left;
+		struct buffer *b = buffer_get (sector,
+				chunk_size < DISK_SECTOR_SIZE);
+
+		memcpy (b->data + sector_ofs, buffer, chunk_size);
+		b->valid = true;
+		if (meta) {
+			journal_log (sector, b->data);
+			b->dirty = false;
+		} else {
+			journal_forget (sector);
+			if (!b->dirty) {
+				b->dirty = true;
+				b->dirty_since = timer_ticks ();
+			}
+		}
+		lock_release (&b->lock);
+
+		sector++;
+		sector_ofs = 0;
+		buffer += chunk_size;
+		size -= chunk_size;
+	}
+}
+
+/* Writes SIZE bytes from BUFFER at SECTOR_OFS within SECTOR, keeping
+ * the rest of the sector.  Like buffer_cache_read(), the bytes may run
+ * on into the sectors that follow; sectors overwritten completely are
+ * not read. */
+void
+buffer_cache_write (disk_sector_t sector, const void *buffer, int sector_ofs,
+		int size) {
+	buffer_write (sector, buffer, sector_ofs, size, false);
+}
+
+/* Like buffer_cache_write(), for metadata, which is written in place
+ * only after the journal commits it. */
+void
+buffer_cache_write_meta (disk_sector_t sector, const void *buffer,
+		int sector_ofs, int size) {
+	buffer_write (sector, buffer, sector_ofs, size, true);
+}
+
+/* Writes back the buffers that have been dirty for AGE ticks or
+ * more. */
+static void
+buffer_cache_write_back (int64_t age) {
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct buffer *b = &buffers[i];
+
+		lock_acquire (&b->lock);
+		if (b->dirty && timer_elapsed (b->dirty_since) >= age)
+			buffer_write_back (b);
+		lock_release (&b->lock);
+	}
+}
+
+/* Writes every dirty buffer back to the disk. */
+void
+buffer_cache_flush (void) {
+	buffer_cache_write_back (0);
+}
+
+/* Writes SECTOR back to the disk if the buffer cache holds it
+ * modified. */
+void
+buffer_cache_flush_sector (disk_sector_t sector) {
+	struct buffer *b;
+
+	lock_acquire (&buffer_cache_lock);
+	b = buffer_find (sector);
+	lock_release (&buffer_cache_lock);
+	if (b == NULL)
+		return;
+
+	/* B may be replaced before we get it, which writes it back. */
+	lock_acquire (&b->lock);
+	if (b->sector == sector)
+		buffer_write_back (b);
+	lock_release (&b->lock);
+}
+
+/* Writes back buffers that stayed dirty too long. */
+static void
+bcflushd (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+		buffer_cache_write_back (FLUSH_AGE);
+	}
+}
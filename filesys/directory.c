@@ -1,10 +1,13 @@
 #include "filesys/directory.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -19,6 +22,180 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* A directory holds its entries one after another, until it has more
+ * than DIR_LINEAR_MAX of them.  It is then hashed: its first entry is
+ * a header, and the others are the slots of a hash table, probed
+ * linearly from the hash of the name.  A slot that is free and has no
+ * name was never used and ends a probe. */
+#define DIR_LINEAR_MAX 32
+
+/* Stored in place of the inode sector in the header of a hashed
+ * directory. */
+#define DIR_HASH_MAGIC UINT32_MAX
+
+/* Header of a hashed directory, the size of a directory entry.  It is
+ * not in use, so that dir_readdir() skips it. */
+struct dir_header {
+	disk_sector_t magic;                /* DIR_HASH_MAGIC. */
+	uint32_t slot_cnt;                  /* Slots, a power of 2. */
+	uint32_t used_cnt;                  /* Slots in use. */
+	uint32_t filled_cnt;                /* Slots in use or used before. */
+	char unused[NAME_MAX + 1 - 3 * sizeof (uint32_t)];
+	bool in_use;                        /* Always false. */
+};
+
+/* Names looked up recently in each directory, with the inode sector
+ * they name, so that opening the same file again reads no directory.
+ * A name that was not found is cached too, as DCACHE_NEGATIVE. */
+#define DCACHE_SIZE 128
+#define DCACHE_NEGATIVE UINT32_MAX
+
+/* A cached name. */
+struct dcache_entry {
+	struct hash_elem elem;              /* Element in DCACHE. */
+	struct list_elem lru_elem;          /* Element in DCACHE_LRU. */
+	disk_sector_t dir_sector;           /* Inode sector of directory. */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+	disk_sector_t inode_sector;         /* Or DCACHE_NEGATIVE. */
+};
+
+static struct hash dcache;
+static struct list dcache_lru;          /* Most recently used first. */
+static size_t dcache_cnt;
+/* Changed by every dir_add() and dir_remove(), so that a lookup that
+ * raced with one does not cache what it read. */
+static unsigned dcache_gen;
+static struct lock dcache_lock;
+
+static uint64_t
+dcache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dcache_entry *d = hash_entry (e, struct dcache_entry, elem);
+	return hash_string (d->name) ^ d->dir_sector;
+}
+
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dcache_entry *a = hash_entry (a_, struct dcache_entry, elem);
+	const struct dcache_entry *b = hash_entry (b_, struct dcache_entry, elem);
+
+	if (a->dir_sector != b->dir_sector)
+		return a->dir_sector < b->dir_sector;
+	return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void) {
+	if (!hash_init (&dcache, dcache_hash, dcache_less, NULL))
+		PANIC ("directory cache creation failed");
+	list_init (&dcache_lru);
+	dcache_cnt = 0;
+	dcache_gen = 0;
+	lock_init (&dcache_lock);
+}
+
+/* Returns the cached entry for NAME in DIR, or a null pointer.
+ * Requires DCACHE_LOCK. */
+static struct dcache_entry *
+dcache_find (const struct dir *dir, const char *name) {
+	struct dcache_entry key;
+	struct hash_elem *e;
+
+	key.dir_sector = inode_get_inumber (dir->inode);
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dcache, &key.elem);
+	return e != NULL ? hash_entry (e, struct dcache_entry, elem) : NULL;
+}
+
+/* Looks NAME up in DIR's cached names.  If it is there, stores the
+ * sector it names, or DCACHE_NEGATIVE, into *SECTORP and returns
+ * true. */
+static bool
+dcache_get (const struct dir *dir, const char *name, disk_sector_t *sectorp) {
+	struct dcache_entry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return false;
+	lock_acquire (&dcache_lock);
+	d = dcache_find (dir, name);
+	if (d != NULL) {
+		list_remove (&d->lru_elem);
+		list_push_front (&dcache_lru, &d->lru_elem);
+		*sectorp = d->inode_sector;
+	}
+	lock_release (&dcache_lock);
+	return d != NULL;
+}
+
+/* Caches SECTOR, or DCACHE_NEGATIVE, as what NAME names in DIR.
+ * Replaces the least recently used name if the cache is full.
+ * Requires DCACHE_LOCK. */
+static void
+dcache_set (const struct dir *dir, const char *name, disk_sector_t sector) {
+	struct dcache_entry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+	d = dcache_find (dir, name);
+	if (d == NULL) {
+		if (dcache_cnt < DCACHE_SIZE) {
+			d = malloc (sizeof *d);
+			if (d == NULL)
+				return;
+			dcache_cnt++;
+		} else {
+			d = list_entry (list_back (&dcache_lru), struct dcache_entry,
+					lru_elem);
+			hash_delete (&dcache, &d->elem);
+		}
+		d->dir_sector = inode_get_inumber (dir->inode);
+		strlcpy (d->name, name, sizeof d->name);
+		hash_insert (&dcache, &d->elem);
+	} else
+		list_remove (&d->lru_elem);
+	list_push_front (&dcache_lru, &d->lru_elem);
+	d->inode_sector = sector;
+}
+
+/* Caches SECTOR, or DCACHE_NEGATIVE, as what a lookup found NAME to
+ * name in DIR, unless DIR changed since DCACHE_GEN was GEN. */
+static void
+dcache_put (const struct dir *dir, const char *name, disk_sector_t sector,
+		unsigned gen) {
+	lock_acquire (&dcache_lock);
+	if (gen == dcache_gen)
+		dcache_set (dir, name, sector);
+	lock_release (&dcache_lock);
+}
+
+/* Caches SECTOR, or DCACHE_NEGATIVE, as what NAME now names in DIR,
+ * after a change to DIR. */
+static void
+dcache_update (const struct dir *dir, const char *name,
+		disk_sector_t sector) {
+	lock_acquire (&dcache_lock);
+	dcache_gen++;
+	dcache_set (dir, name, sector);
+	lock_release (&dcache_lock);
+}
+
+/* Returns the byte offset of hash table slot SLOT. */
+static off_t
+slot_ofs (size_t slot) {
+	return (slot + 1) * sizeof (struct dir_entry);
+}
+
+/* Reads the header of DIR into *H.  Returns true if DIR is hashed,
+ * false if its entries are linear. */
+static bool
+dir_hashed (const struct dir *dir, struct dir_header *h) {
+	ASSERT (sizeof *h == sizeof (struct dir_entry));
+
+	return inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h
+		&& !h->in_use && h->magic == DIR_HASH_MAGIC;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -32,6 +209,7 @@ struct dir *
 dir_open (struct inode *inode) {
 	struct dir *dir = calloc (1, sizeof *dir);
 	if (inode != NULL && dir != NULL) {
+		inode_mark_metadata (inode);
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
@@ -75,28 +253,110 @@ dir_get_inode (struct dir *dir) {
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
  * directory entry if OFSP is non-null.
- * otherwise, returns false and ignores EP and OFSP. */
+ * otherwise, returns false and ignores EP and OFSP.
+ * Either way, sets *FREEP, if FREEP is non-null, to the byte offset of
+ * the slot where NAME would be added: the first free one passed, or
+ * the end of file if there is none. */
 static bool
 lookup (const struct dir *dir, const char *name,
-		struct dir_entry *ep, off_t *ofsp) {
+		struct dir_entry *ep, off_t *ofsp, off_t *freep) {
+	struct dir_header h;
 	struct dir_entry e;
-	size_t ofs;
+	off_t free_ofs = -1;
+	size_t ofs, slot, i;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (e.in_use && !strcmp (name, e.name)) {
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
+	if (!dir_hashed (dir, &h)) {
+		for (ofs = 0;
+				inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+				ofs += sizeof e) {
+			if (e.in_use && !strcmp (name, e.name))
+				goto found;
+			if (!e.in_use && free_ofs < 0)
+				free_ofs = ofs;
 		}
+		if (free_ofs < 0)
+			free_ofs = ofs;
+		goto not_found;
+	}
+
+	slot = hash_string (name) & (h.slot_cnt - 1);
+	for (i = 0; i < h.slot_cnt; i++, slot = (slot + 1) & (h.slot_cnt - 1)) {
+		ofs = slot_ofs (slot);
+		if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+			break;
+		if (e.in_use && !strcmp (name, e.name))
+			goto found;
+		if (!e.in_use && free_ofs < 0)
+			free_ofs = ofs;
+		if (!e.in_use && e.name[0] == '\0')
+			break;
+	}
+	goto not_found;
+
+found:
+	if (ep != NULL)
+		*ep = e;
+	if (ofsp != NULL)
+		*ofsp = ofs;
+	return true;
+
+not_found:
+	if (freep != NULL)
+		*freep = free_ofs;
 	return false;
 }
 
+/* Rewrites DIR as a hashed directory with room for its entries and
+ * ADD_CNT more.  Returns true if successful, false on failure. */
+static bool
+dir_rehash (struct dir *dir, size_t add_cnt) {
+	size_t file_cnt = inode_length (dir->inode) / sizeof (struct dir_entry);
+	size_t used_cnt = 0, slot_cnt, table_cnt;
+	struct dir_entry *table, e;
+	struct dir_header *h;
+	off_t ofs, size;
+	bool success;
+
+	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+			ofs += sizeof e)
+		if (e.in_use)
+			used_cnt++;
+
+	/* Keep the table no more than half full. */
+	slot_cnt = DIR_LINEAR_MAX * 2;
+	while (slot_cnt < (used_cnt + add_cnt) * 2)
+		slot_cnt *= 2;
+
+	/* Build the table in memory, and overwrite the whole directory. */
+	table_cnt = slot_cnt + 1 > file_cnt ? slot_cnt + 1 : file_cnt;
+	table = calloc (table_cnt, sizeof *table);
+	if (table == NULL)
+		return false;
+	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+			ofs += sizeof e) {
+		size_t slot;
+
+		if (!e.in_use)
+			continue;
+		slot = hash_string (e.name) & (slot_cnt - 1);
+		while (table[slot + 1].in_use)
+			slot = (slot + 1) & (slot_cnt - 1);
+		table[slot + 1] = e;
+	}
+	h = (struct dir_header *) &table[0];
+	h->magic = DIR_HASH_MAGIC;
+	h->slot_cnt = slot_cnt;
+	h->used_cnt = h->filled_cnt = used_cnt;
+
+	size = table_cnt * sizeof *table;
+	success = inode_write_at (dir->inode, table, size, 0) == size;
+	free (table);
+	return success;
+}
+
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
@@ -105,12 +365,22 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
 	struct dir_entry e;
+	disk_sector_t sector;
+	unsigned gen;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
+	if (!dcache_get (dir, name, &sector)) {
+		inode_lock_dir (dir->inode);
+		gen = dcache_gen;
+		sector = lookup (dir, name, &e, NULL, NULL)
+			? e.inode_sector : DCACHE_NEGATIVE;
+		dcache_put (dir, name, sector, gen);
+		inode_unlock_dir (dir->inode);
+	}
+	if (sector != DCACHE_NEGATIVE)
+		*inode = inode_open (sector);
 	else
 		*inode = NULL;
 
@@ -125,8 +395,10 @@ dir_lookup (const struct dir *dir, const char *name,
  * error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+	struct dir_header h;
 	struct dir_entry e;
 	off_t ofs;
+	bool hashed;
 	bool success = false;
 
 	ASSERT (dir != NULL);
@@ -136,29 +408,49 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (*name == '\0' || strlen (name) > NAME_MAX)
 		return false;
 
-	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	/* Check that NAME is not in use, and set OFS to the offset of a
+	 * free slot for it.  In a linear directory with no free slots,
+	 * that is the current end-of-file. */
+	inode_lock_dir (dir->inode);
+	if (lookup (dir, name, NULL, NULL, &ofs))
 		goto done;
 
-	/* Set OFS to offset of free slot.
-	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
+	/* Hash a linear directory that would grow too long, and grow a
+	 * hash table that would be more than 3/4 filled. */
+	hashed = dir_hashed (dir, &h);
+	if (hashed
+			? ofs < 0 || (h.filled_cnt + 1) * 4 > h.slot_cnt * 3
+			: ofs / sizeof e >= DIR_LINEAR_MAX) {
+		if (!dir_rehash (dir, 1)
+				|| !dir_hashed (dir, &h)
+				|| lookup (dir, name, NULL, NULL, &ofs)
+				|| ofs < 0)
+			goto done;
+		hashed = true;
+	}
 
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
+	/* Count the slot in the header of a hashed directory.  A slot
+	 * that was never used is newly filled. */
+	if (hashed) {
+		if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+			goto done;
+		h.used_cnt++;
+		if (e.name[0] == '\0')
+			h.filled_cnt++;
+		if (inode_write_at (dir->inode, &h, sizeof h, 0) != sizeof h)
+			goto done;
+	}
 
 	/* Write slot. */
 	e.in_use = true;
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+	if (success)
+		dcache_update (dir, name, inode_sector);
 
 done:
+	inode_unlock_dir (dir->inode);
 	return success;
 }
 
@@ -167,6 +459,7 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool
 dir_remove (struct dir *dir, const char *name) {
+	struct dir_header h;
 	struct dir_entry e;
 	struct inode *inode = NULL;
 	bool success = false;
@@ -176,7 +469,8 @@ dir_remove (struct dir *dir, const char *name) {
 	ASSERT (name != NULL);
 
 	/* Find directory entry. */
-	if (!lookup (dir, name, &e, &ofs))
+	inode_lock_dir (dir->inode);
+	if (!lookup (dir, name, &e, &ofs, NULL))
 		goto done;
 
 	/* Open inode. */
@@ -184,16 +478,23 @@ dir_remove (struct dir *dir, const char *name) {
 	if (inode == NULL)
 		goto done;
 
-	/* Erase directory entry. */
+	/* Erase directory entry.  Its name is kept, so that a probe in a
+	 * hashed directory goes on past it. */
 	e.in_use = false;
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
+	dcache_update (dir, name, DCACHE_NEGATIVE);
+	if (dir_hashed (dir, &h)) {
+		h.used_cnt--;
+		inode_write_at (dir->inode, &h, sizeof h, 0);
+	}
 
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
 
 done:
+	inode_unlock_dir (dir->inode);
 	inode_close (inode);
 	return success;
 }
@@ -204,13 +505,17 @@ done:
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 	struct dir_entry e;
+	bool success = false;
 
+	inode_lock_dir (dir->inode);
 	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
 		dir->pos += sizeof e;
 		if (e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
-			return true;
+			success = true;
+			break;
 		}
 	}
-	return false;
+	inode_unlock_dir (dir->inode);
+	return success;
 }
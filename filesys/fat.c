@@ -1,6 +1,9 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
 #include "devices/disk.h"
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include <stdio.h>
@@ -9,7 +12,7 @@
 /* Should be less than DISK_SECTOR_SIZE */
 struct fat_boot {
 	unsigned int magic;
-	unsigned int sectors_per_cluster; /* Fixed to 1 */
+	unsigned int sectors_per_cluster; /* 1 to MAX_SECTORS_PER_CLUSTER */
 	unsigned int total_sectors;
 	unsigned int fat_start;
 	unsigned int fat_sectors; /* Size of FAT in sectors. */
@@ -24,10 +27,52 @@ struct fat_fs {
 	disk_sector_t data_start;
 	cluster_t last_clst;
 	struct lock write_lock;
+
+	/* Clusters in use, so that a free one is found without reading
+	 * the FAT entry by entry.  Cluster 0 is never used. */
+	struct bitmap *used;
+	/* FAT sectors changed since the FAT was last written. */
+	struct bitmap *dirty;
+	/* Of those, the ones in which a cluster was allocated, and their
+	 * number.  They are committed along with the inodes that use the
+	 * clusters; the others only free clusters, and may wait. */
+	struct bitmap *allocated;
+	size_t allocated_cnt;
 };
 
 static struct fat_fs *fat_fs;
 
+unsigned int fat_format_cluster_sectors;
+
+/* Clusters on a disk beyond which a bigger cluster size is chosen, as
+ * for FAT16. */
+#define FAT_DEFAULT_CLUSTERS 65536
+
+/* Entries of the FAT in a sector. */
+#define FAT_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (cluster_t))
+
+/* Allocates an empty FAT and its bitmaps, freeing any old ones. */
+static void
+fat_alloc_table (void) {
+	free (fat_fs->fat);
+	if (fat_fs->used != NULL)
+		bitmap_destroy (fat_fs->used);
+	if (fat_fs->dirty != NULL)
+		bitmap_destroy (fat_fs->dirty);
+	if (fat_fs->allocated != NULL)
+		bitmap_destroy (fat_fs->allocated);
+
+	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
+	fat_fs->used = bitmap_create (fat_fs->fat_length);
+	fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	fat_fs->allocated = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->fat == NULL || fat_fs->used == NULL || fat_fs->dirty == NULL
+	    || fat_fs->allocated == NULL)
+		PANIC ("FAT allocation failed");
+	fat_fs->allocated_cnt = 0;
+	bitmap_mark (fat_fs->used, 0);
+}
+
 void fat_boot_create (void);
 void fat_fs_init (void);
 
@@ -38,12 +83,7 @@ fat_init (void) {
 		PANIC ("FAT init failed");
 
 	// Read boot sector from the disk
-	unsigned int *bounce = malloc (DISK_SECTOR_SIZE);
-	if (bounce == NULL)
-		PANIC ("FAT init failed");
-	disk_read (filesys_disk, FAT_BOOT_SECTOR, bounce);
-	memcpy (&fat_fs->bs, bounce, sizeof (fat_fs->bs));
-	free (bounce);
+	buffer_cache_read (FAT_BOOT_SECTOR, &fat_fs->bs, 0, sizeof (fat_fs->bs));
 
 	// Extract FAT info
 	if (fat_fs->bs.magic != FAT_MAGIC)
@@ -53,31 +93,25 @@ fat_init (void) {
 
 void
 fat_open (void) {
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT load failed");
+	fat_alloc_table ();
 
-	// Load FAT directly from the disk
+	// Load FAT from the disk
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
 	off_t bytes_read = 0;
 	off_t bytes_left = sizeof (fat_fs->fat);
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
 	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
 		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
+		if (bytes_left > DISK_SECTOR_SIZE)
+			bytes_left = DISK_SECTOR_SIZE;
+		buffer_cache_read (fat_fs->bs.fat_start + i, buffer + bytes_read, 0,
+				bytes_left);
+		bytes_read += bytes_left;
 	}
+
+	for (cluster_t clst = 1; clst < fat_fs->fat_length; clst++)
+		if (fat_fs->fat[clst] != 0)
+			bitmap_mark (fat_fs->used, clst);
 }
 
 void
@@ -87,42 +121,89 @@ fat_close (void) {
 	if (bounce == NULL)
 		PANIC ("FAT close failed");
 	memcpy (bounce, &fat_fs->bs, sizeof (fat_fs->bs));
-	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
+	journal_begin ();
+	buffer_cache_write_meta (FAT_BOOT_SECTOR, bounce, 0, DISK_SECTOR_SIZE);
+	journal_end ();
 	free (bounce);
 
-	// Write FAT directly to the disk
+	// Commit it along with the FAT
+	journal_commit ();
+}
+
+/* Writes FAT sector I through the journal, using BOUNCE for a last
+ * sector that the FAT fills only partly.  Requires the FAT lock. */
+static void
+fat_write_sector (unsigned i, uint8_t *bounce) {
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
+	off_t bytes_wrote = i * DISK_SECTOR_SIZE;
+	off_t bytes_left = fat_size_in_bytes - bytes_wrote;
+
+	if (bytes_left >= DISK_SECTOR_SIZE)
+		buffer_cache_write_meta (fat_fs->bs.fat_start + i,
+		                         buffer + bytes_wrote, 0, DISK_SECTOR_SIZE);
+	else {
+		memset (bounce, 0, DISK_SECTOR_SIZE);
+		if (bytes_left > 0)
 			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
+		buffer_cache_write_meta (fat_fs->bs.fat_start + i, bounce, 0,
+		                         DISK_SECTOR_SIZE);
+	}
+	bitmap_reset (fat_fs->dirty, i);
+	if (bitmap_test (fat_fs->allocated, i)) {
+		bitmap_reset (fat_fs->allocated, i);
+		fat_fs->allocated_cnt--;
 	}
 }
 
+/* Writes the sectors of the FAT in which a cluster was allocated since
+ * it was last written, and of those that only free clusters, as many
+ * as fit in the MAX sectors left to write.  Returns true if no changed
+ * sector is left.  The journal calls it as it commits; a sector left
+ * to a later commit only leaves the clusters it frees in use should
+ * the system crash in between. */
+bool
+fat_flush (size_t max) {
+	bool done;
+	uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
+	if (bounce == NULL)
+		PANIC ("FAT flush failed");
+
+	lock_acquire (&fat_fs->write_lock);
+	ASSERT (fat_fs->allocated_cnt <= max);
+	max -= fat_fs->allocated_cnt;
+	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++)
+		if (bitmap_test (fat_fs->allocated, i))
+			fat_write_sector (i, bounce);
+	for (unsigned i = 0; i < fat_fs->bs.fat_sectors && max > 0; i++)
+		if (bitmap_test (fat_fs->dirty, i)) {
+			fat_write_sector (i, bounce);
+			max--;
+		}
+	done = bitmap_none (fat_fs->dirty, 0, fat_fs->bs.fat_sectors);
+	lock_release (&fat_fs->write_lock);
+	free (bounce);
+	return done;
+}
+
+/* Returns the number of FAT sectors in which a cluster was allocated
+ * since the FAT was last written, which the next commit must write.
+ * The journal reads it without the FAT lock, which is acquired before
+ * its own lock. */
+size_t
+fat_allocated_cnt (void) {
+	return fat_fs->allocated_cnt;
+}
+
 void
 fat_create (void) {
 	// Create FAT boot
 	fat_boot_create ();
 	fat_fs_init ();
 
-	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT creation failed");
+	// Create FAT table, all of which is written out
+	fat_alloc_table ();
+	bitmap_set_all (fat_fs->dirty, true);
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
@@ -131,20 +212,34 @@ fat_create (void) {
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
 	if (buf == NULL)
 		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
+	buffer_cache_write_meta (cluster_to_sector (ROOT_DIR_CLUSTER), buf, 0,
+	                         DISK_SECTOR_SIZE);
 	free (buf);
 }
 
 void
 fat_boot_create (void) {
+	unsigned int sectors_per_cluster = fat_format_cluster_sectors;
+	if (sectors_per_cluster == 0) {
+		sectors_per_cluster = 1;
+		while (sectors_per_cluster < MAX_SECTORS_PER_CLUSTER
+		       && disk_size (filesys_disk) / sectors_per_cluster
+		              > FAT_DEFAULT_CLUSTERS)
+			sectors_per_cluster *= 2;
+	}
+	ASSERT (sectors_per_cluster >= 1
+	        && sectors_per_cluster <= MAX_SECTORS_PER_CLUSTER);
+
+	/* The journal lies between the boot sector and the FAT. */
+	unsigned int fat_start = JOURNAL_SECTOR + JOURNAL_SECTORS;
 	unsigned int fat_sectors =
-	    (disk_size (filesys_disk) - 1)
-	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * SECTORS_PER_CLUSTER + 1) + 1;
+	    (disk_size (filesys_disk) - fat_start)
+	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * sectors_per_cluster + 1) + 1;
 	fat_fs->bs = (struct fat_boot){
 	    .magic = FAT_MAGIC,
-	    .sectors_per_cluster = SECTORS_PER_CLUSTER,
+	    .sectors_per_cluster = sectors_per_cluster,
 	    .total_sectors = disk_size (filesys_disk),
-	    .fat_start = 1,
+	    .fat_start = fat_start,
 	    .fat_sectors = fat_sectors,
 	    .root_dir_cluster = ROOT_DIR_CLUSTER,
 	};
@@ -152,42 +247,113 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	/* Data clusters follow the FAT and are numbered from 1; entry 0 of
+	 * the FAT is unused. */
+	unsigned int data_sectors;
+
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	data_sectors = fat_fs->bs.total_sectors - fat_fs->data_start;
+	fat_fs->fat_length = data_sectors / fat_fs->bs.sectors_per_cluster + 1;
+	if (fat_fs->fat_length > fat_fs->bs.fat_sectors * FAT_PER_SECTOR)
+		fat_fs->fat_length = fat_fs->bs.fat_sectors * FAT_PER_SECTOR;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
+	lock_init (&fat_fs->write_lock);
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Sets entry CLST of the FAT to VAL and notes that its sector changed.
+ * Requires the FAT lock. */
+static void
+fat_set (cluster_t clst, cluster_t val) {
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+
+	fat_fs->fat[clst] = val;
+	bitmap_set (fat_fs->used, clst, val != 0);
+	bitmap_mark (fat_fs->dirty, clst / FAT_PER_SECTOR);
+	if (val != 0 && !bitmap_test (fat_fs->allocated, clst / FAT_PER_SECTOR)) {
+		bitmap_mark (fat_fs->allocated, clst / FAT_PER_SECTOR);
+		fat_fs->allocated_cnt++;
+	}
+}
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
- * Returns 0 if fails to allocate a new cluster. */
+ * Returns 0 if fails to allocate a new cluster.
+ * The search for a free cluster starts right after CLST, so that a
+ * file is laid out in order, or for a new chain where the last one was
+ * found. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	cluster_t goal = clst != 0 ? clst + 1 : fat_fs->last_clst;
+	size_t new;
+
+	lock_acquire (&fat_fs->write_lock);
+	if (goal >= fat_fs->fat_length)
+		goal = 1;
+	new = bitmap_scan (fat_fs->used, goal, 1, false);
+	if (new == BITMAP_ERROR)
+		new = bitmap_scan (fat_fs->used, 1, 1, false);
+	if (new != BITMAP_ERROR) {
+		fat_set (new, EOChain);
+		if (clst != 0)
+			fat_set (clst, new);
+		fat_fs->last_clst = new;
+	}
+	lock_release (&fat_fs->write_lock);
+	return new != BITMAP_ERROR ? new : 0;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_set (pclst, EOChain);
+	while (clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+
+		ASSERT (next != 0);
+		fat_set (clst, 0);
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	fat_set (clst, val);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * fat_fs->bs.sectors_per_cluster;
+}
+
+/* Returns the number of sectors in a cluster. */
+unsigned int
+fat_cluster_sectors (void) {
+	return fat_fs->bs.sectors_per_cluster;
+}
+
+/* Converts SECTOR, the first sector of a cluster, to its cluster #. */
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
+	ASSERT (sector >= fat_fs->data_start);
+	return (sector - fat_fs->data_start) / fat_fs->bs.sectors_per_cluster + 1;
 }
@@ -1,21 +1,114 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Sectors in a region of the disk. */
+#define REGION_SECTORS 512
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* Free sectors in each region, so that the search for a free sector
+ * skips full regions without testing their bits. */
+static unsigned *region_free;
+static size_t region_cnt;
+
+/* Bits of the free map in a sector of the free map file. */
+#define BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+
+/* Sectors of the free map file changed since it was last written.
+ * The free map is written out by free_map_flush(), not on every
+ * change. */
+static struct bitmap *dirty;
+
+/* Of those, the ones in which a sector was allocated, and their
+ * number.  They are committed along with the inodes that use the
+ * sectors; the others only free sectors, and may wait. */
+static struct bitmap *allocated;
+static size_t allocated_cnt;
+
+/* Sectors are allocated for pages written back by the page cache
+ * as well as by system calls. */
+static struct lock free_map_lock;
+
+static void region_count (void);
+
 /* Initializes the free map. */
 void
 free_map_init (void) {
 	free_map = bitmap_create (disk_size (filesys_disk));
 	if (free_map == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
+	lock_init (&free_map_lock);
+	region_cnt = DIV_ROUND_UP (bitmap_size (free_map), REGION_SECTORS);
+	region_free = malloc (region_cnt * sizeof *region_free);
+	dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+				BITS_PER_SECTOR));
+	allocated = bitmap_create (bitmap_size (dirty));
+	if (region_free == NULL || dirty == NULL || allocated == NULL)
+		PANIC ("free map region creation failed");
+	allocated_cnt = 0;
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+	bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+	region_count ();
+}
+
+/* Counts the free sectors of every region. */
+static void
+region_count (void) {
+	for (size_t i = 0; i < region_cnt; i++) {
+		size_t start = i * REGION_SECTORS;
+		size_t cnt = bitmap_size (free_map) - start;
+
+		if (cnt > REGION_SECTORS)
+			cnt = REGION_SECTORS;
+		region_free[i] = bitmap_count (free_map, start, cnt, false);
+	}
+}
+
+/* Marks the CNT sectors starting at SECTOR used if USED is true, free
+ * otherwise, and updates the free counts of their regions. */
+static void
+region_set (size_t sector, size_t cnt, bool used) {
+	bitmap_set_multiple (free_map, sector, cnt, used);
+	for (size_t i = sector / BITS_PER_SECTOR;
+			i <= (sector + cnt - 1) / BITS_PER_SECTOR; i++) {
+		bitmap_mark (dirty, i);
+		if (used && !bitmap_test (allocated, i)) {
+			bitmap_mark (allocated, i);
+			allocated_cnt++;
+		}
+	}
+	for (size_t i = sector; i < sector + cnt; i++) {
+		if (used)
+			region_free[i / REGION_SECTORS]--;
+		else
+			region_free[i / REGION_SECTORS]++;
+	}
+}
+
+/* Returns the first sector of a run of CNT free sectors at or after
+ * FROM, or BITMAP_ERROR if there is none.  Regions with no free sector
+ * are skipped by their counts, and the rest is scanned a word at a
+ * time. */
+static size_t
+region_scan (size_t from, size_t cnt) {
+	size_t region;
+
+	for (region = from / REGION_SECTORS;
+			region < region_cnt && region_free[region] == 0; region++)
+		from = (region + 1) * REGION_SECTORS;
+	if (region == region_cnt)
+		return BITMAP_ERROR;
+	return bitmap_scan (free_map, from, cnt, false);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -24,24 +117,91 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
-	}
-	if (sector != BITMAP_ERROR)
+	return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the first free run at or after
+ * GOAL, wrapping around to the start of the disk, so that a file's
+ * sectors follow each other and lie near its directory. */
+bool
+free_map_allocate_near (disk_sector_t goal, size_t cnt,
+		disk_sector_t *sectorp) {
+	size_t sector;
+
+	lock_acquire (&free_map_lock);
+	if (goal >= bitmap_size (free_map))
+		goal = 0;
+	sector = region_scan (goal, cnt);
+	if (sector == BITMAP_ERROR && goal > 0)
+		sector = region_scan (0, cnt);
+	if (sector != BITMAP_ERROR) {
+		region_set (sector, cnt, true);
 		*sectorp = sector;
+	}
+	lock_release (&free_map_lock);
 	return sector != BITMAP_ERROR;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
+	lock_acquire (&free_map_lock);
 	ASSERT (bitmap_all (free_map, sector, cnt));
-	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	region_set (sector, cnt, false);
+	lock_release (&free_map_lock);
+}
+
+/* Writes sector I of the free map file.  Requires free_map_lock. */
+static void
+flush_sector (size_t i) {
+	size_t start = i * BITS_PER_SECTOR;
+	size_t cnt = bitmap_size (free_map) - start;
+
+	if (cnt > BITS_PER_SECTOR)
+		cnt = BITS_PER_SECTOR;
+	if (!bitmap_write_part (free_map, free_map_file, start, cnt))
+		PANIC ("can't write free map");
+	bitmap_reset (dirty, i);
+	if (bitmap_test (allocated, i)) {
+		bitmap_reset (allocated, i);
+		allocated_cnt--;
+	}
+}
+
+/* Writes the sectors of the free map file in which a sector was
+ * allocated since it was last written, and of those that only free
+ * sectors, as many as fit in the MAX sectors left to write.  Returns
+ * true if no changed sector is left.  The journal calls it as it
+ * commits, so that the free map is committed with the inodes that use
+ * its sectors; a sector left to a later commit only leaves the sectors
+ * it frees in use should the system crash in between. */
+bool
+free_map_flush (size_t max) {
+	bool done;
+
+	lock_acquire (&free_map_lock);
+	ASSERT (allocated_cnt <= max);
+	max -= allocated_cnt;
+	for (size_t i = 0; i < bitmap_size (dirty); i++)
+		if (bitmap_test (allocated, i))
+			flush_sector (i);
+	for (size_t i = 0; i < bitmap_size (dirty) && max > 0; i++)
+		if (bitmap_test (dirty, i)) {
+			flush_sector (i);
+			max--;
+		}
+	done = bitmap_none (dirty, 0, bitmap_size (dirty));
+	lock_release (&free_map_lock);
+	return done;
+}
+
+/* Returns the number of sectors of the free map file in which a
+ * sector was allocated since it was last written, which the next
+ * commit must write.  The journal reads it without free_map_lock,
+ * which is acquired before its own lock. */
+size_t
+free_map_allocated_cnt (void) {
+	return allocated_cnt;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -52,11 +212,13 @@ free_map_open (void) {
 		PANIC ("can't open free map");
 	if (!bitmap_read (free_map, free_map_file))
 		PANIC ("can't read free map");
+	region_count ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) {
+	journal_commit ();
 	file_close (free_map_file);
 }
 
@@ -72,6 +234,19 @@ free_map_create (void) {
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
-	if (!bitmap_write (free_map, free_map_file))
-		PANIC ("can't write free map");
+	bitmap_set_all (dirty, false);
+	bitmap_set_all (allocated, false);
+	allocated_cnt = 0;
+	for (size_t start = 0; start < bitmap_size (free_map);
+			start += BITS_PER_SECTOR) {
+		size_t cnt = bitmap_size (free_map) - start;
+
+		/* A sector at a time, each written by an operation of its own,
+		 * so that a large free map fits in the journal.  The sectors
+		 * that the file takes are written out as it is closed. */
+		if (cnt > BITS_PER_SECTOR)
+			cnt = BITS_PER_SECTOR;
+		if (!bitmap_write_part (free_map, free_map_file, start, cnt))
+			PANIC ("can't write free map");
+	}
 }
@@ -1,73 +1,514 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/page_cache.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+#ifdef EFILESYS
+/* Bytes in a cluster, the run of sectors that is contiguous on disk
+ * and read and written at once. */
+#define BLOCK_SIZE ((off_t) fat_cluster_sectors () * DISK_SECTOR_SIZE)
+
+/* Every CHECKPOINT_STRIDE-th cluster of a file reached is remembered,
+ * in one of CHECKPOINT_CNT slots. */
+#define CHECKPOINT_STRIDE 32
+#define CHECKPOINT_CNT 16
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * The data are held by the chain of clusters that starts at START.
+ * The chain may end before the file does; the rest reads as zeros,
+ * and the chain is extended when it is written. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
+	cluster_t start;                    /* First data cluster, or 0. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
 	uint32_t unused[125];               /* Not used. */
 };
 
-/* Returns the number of sectors to allocate for an inode SIZE
- * bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size) {
-	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
-}
+/* A cluster in the chain of a file. */
+struct checkpoint {
+	size_t idx;                         /* Its index within the file. */
+	cluster_t clst;                     /* The cluster, or 0 if none. */
+};
+#else
+/* Bytes read and written at once. */
+#define BLOCK_SIZE DISK_SECTOR_SIZE
+
+/* Sector pointers held by the on-disk inode itself, and by a pointer
+ * block. */
+#define DIRECT_CNT 124
+#define PTRS_PER_BLOCK (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+
+/* On-disk inode.
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * A sector pointer of 0 is a hole that reads as zeros; sector 0 never
+ * holds file data. */
+struct inode_disk {
+	off_t length;                       /* File size in bytes. */
+	unsigned magic;                     /* Magic number. */
+	disk_sector_t direct[DIRECT_CNT];   /* First data sectors. */
+	disk_sector_t indirect;             /* Block of data sector pointers. */
+	disk_sector_t doubly_indirect;      /* Block of indirect blocks. */
+};
+
+/* A pointer block kept in memory. */
+struct ptr_cache {
+	disk_sector_t sector;               /* Its sector, or 0 if none. */
+	disk_sector_t *ptrs;                /* PTRS_PER_BLOCK pointers. */
+};
+#endif
 
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open_inodes. */
+	struct list_elem lru_elem;          /* Element in closed_inodes. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
+	bool evicting;                      /* Being dropped from memory? */
 	bool removed;                       /* True if deleted, false otherwise. */
+	bool metadata;                      /* Holds the free map or a directory? */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
 	struct inode_disk data;             /* Inode content. */
+#ifdef VM
+	struct list pages;                  /* Its pages in the page cache. */
+#endif
+
+	/* Held to read by inode_read_at() and to write by inode_write_at(),
+	 * so that reads of a file proceed in parallel and see writes
+	 * whole. */
+	struct rwlock rw;
+	/* Held while a directory held by the inode is searched or
+	 * changed. */
+	struct lock dir_lock;
+
+	/* Protects the index of the data sectors and the length. */
+	struct lock lock;
+#ifdef EFILESYS
+	/* Clusters found by walking the chain: the last one, and
+	 * checkpoints along the way, so that a seek walks from the nearest
+	 * one before it instead of from the start. */
+	struct checkpoint last;
+	struct checkpoint checkpoints[CHECKPOINT_CNT];
+#else
+	/* Last pointer block used: [0] for the top level of the doubly
+	 * indirect block, [1] for the indirect block or a second-level
+	 * block, so that finding a sector takes no more than reading
+	 * memory once they are loaded. */
+	struct ptr_cache ptr_cache[2];
+	/* Where to look for the next sector allocated for the inode. */
+	disk_sector_t alloc_goal;
+#endif
 };
 
+/* Allocates a sector for a new inode and stores it into *SECTORP,
+ * preferably at or after GOAL, the inode of its directory.  With FAT,
+ * the inode takes a cluster of its own, wherever the next free one
+ * is.  Returns false if the disk is full. */
+bool
+inode_sector_allocate (disk_sector_t goal UNUSED, disk_sector_t *sectorp) {
+#ifdef EFILESYS
+	cluster_t clst = fat_create_chain (0);
+
+	if (clst == 0)
+		return false;
+	*sectorp = cluster_to_sector (clst);
+	return true;
+#else
+	return free_map_allocate_near (goal, 1, sectorp);
+#endif
+}
+
+/* Frees SECTOR, allocated by inode_sector_allocate(). */
+void
+inode_sector_release (disk_sector_t sector) {
+#ifdef EFILESYS
+	fat_remove_chain (sector_to_cluster (sector), 0);
+#else
+	free_map_release (sector, 1);
+#endif
+}
+
+#ifdef EFILESYS
+/* Adds a cluster filled with zeros to the chain that ends at CLST, or
+ * starts a new chain if CLST is 0.  Returns the new cluster, or 0 if
+ * the disk is full. */
+static cluster_t
+cluster_alloc (cluster_t clst) {
+	static char zeros[DISK_SECTOR_SIZE];
+	cluster_t new = fat_create_chain (clst);
+
+	if (new != 0)
+		for (unsigned int i = 0; i < fat_cluster_sectors (); i++)
+			buffer_cache_write (cluster_to_sector (new) + i, zeros, 0,
+					DISK_SECTOR_SIZE);
+	return new;
+}
+
+/* Returns the cluster at index IDX within INODE's chain.
+ * Returns 0 if the chain is shorter, unless CREATE is true, in which
+ * case the chain is extended with zeroed clusters first; 0 is then
+ * returned only if the disk is full.  Requires INODE's lock. */
+static cluster_t
+chain_get (struct inode *inode, size_t idx, bool create) {
+	struct checkpoint pos = { 0, inode->data.start };
+
+	if (pos.clst == 0) {
+		if (!create || (pos.clst = cluster_alloc (0)) == 0)
+			return 0;
+		inode->data.start = pos.clst;
+		buffer_cache_write_meta (inode->sector, &inode->data, 0,
+				DISK_SECTOR_SIZE);
+	}
+
+	/* Start from the nearest cluster known at or before IDX. */
+	for (int i = 0; i <= CHECKPOINT_CNT; i++) {
+		struct checkpoint *cp = i < CHECKPOINT_CNT
+			? &inode->checkpoints[i] : &inode->last;
+		if (cp->clst != 0 && cp->idx <= idx && cp->idx > pos.idx)
+			pos = *cp;
+	}
+
+	while (pos.idx < idx) {
+		cluster_t next = fat_get (pos.clst);
+
+		if (next == EOChain
+				&& (!create || (next = cluster_alloc (pos.clst)) == 0))
+			return 0;
+		pos.idx++;
+		pos.clst = next;
+		if (pos.idx % CHECKPOINT_STRIDE == 0)
+			inode->checkpoints[pos.idx / CHECKPOINT_STRIDE
+				% CHECKPOINT_CNT] = pos;
+	}
+	inode->last = pos;
+	return pos.clst;
+}
+
+/* Returns the number of clusters in INODE's chain.  Requires INODE's
+ * lock. */
+static size_t
+chain_length (struct inode *inode) {
+	struct checkpoint pos = { 0, inode->data.start };
+	cluster_t next;
+
+	if (pos.clst == 0)
+		return 0;
+
+	/* Start from the furthest cluster known. */
+	for (int i = 0; i <= CHECKPOINT_CNT; i++) {
+		struct checkpoint *cp = i < CHECKPOINT_CNT
+			? &inode->checkpoints[i] : &inode->last;
+		if (cp->clst != 0 && cp->idx > pos.idx)
+			pos = *cp;
+	}
+
+	while ((next = fat_get (pos.clst)) != EOChain) {
+		pos.idx++;
+		pos.clst = next;
+		if (pos.idx % CHECKPOINT_STRIDE == 0)
+			inode->checkpoints[pos.idx / CHECKPOINT_STRIDE
+				% CHECKPOINT_CNT] = pos;
+	}
+	inode->last = pos;
+	return pos.idx + 1;
+}
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
- * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * Returns 0 if INODE's chain does not reach POS.  If CREATE is true,
+ * the chain is extended up to POS instead; 0 is then returned only if
+ * the disk is full.  Requires INODE's lock. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos, bool create) {
+	cluster_t clst;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
-		return -1;
+	ASSERT (pos >= 0);
+
+	clst = chain_get (inode, pos / BLOCK_SIZE, create);
+	return clst != 0
+		? cluster_to_sector (clst) + pos % BLOCK_SIZE / DISK_SECTOR_SIZE
+		: 0;
+}
+
+/* Forgets the clusters found in INODE's chain. */
+static void
+chain_forget (struct inode *inode) {
+	inode->last.clst = 0;
+	for (int i = 0; i < CHECKPOINT_CNT; i++)
+		inode->checkpoints[i].clst = 0;
+}
+
+/* Releases the chain of data clusters of INODE. */
+static void
+inode_release (struct inode *inode) {
+	if (inode->data.start != 0)
+		fat_remove_chain (inode->data.start, 0);
+	inode->data.start = 0;
+	chain_forget (inode);
+}
+#else
+/* Allocates a sector filled with zeros for INODE and stores it into
+ * *SECTORP.  The sector is taken right after the last one allocated
+ * for INODE if it is free, so that a file written in order is laid out
+ * in order.  Returns false if the disk is full.  Requires INODE's
+ * lock. */
+static bool
+sector_alloc (struct inode *inode, disk_sector_t *sectorp) {
+	static char zeros[DISK_SECTOR_SIZE];
+
+	if (!free_map_allocate_near (inode->alloc_goal, 1, sectorp))
+		return false;
+	inode->alloc_goal = *sectorp + 1;
+	buffer_cache_write (*sectorp, zeros, 0, DISK_SECTOR_SIZE);
+	return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns pointer IDX of the pointer block at BLOCK, loading the block
+ * into INODE's pointer cache LEVEL.  Requires INODE's lock. */
+static disk_sector_t
+ptr_get (struct inode *inode, int level, disk_sector_t block, size_t idx) {
+	struct ptr_cache *cache = &inode->ptr_cache[level];
+	disk_sector_t sector;
+
+	if (cache->sector != block) {
+		if (cache->ptrs == NULL)
+			cache->ptrs = malloc (DISK_SECTOR_SIZE);
+		if (cache->ptrs == NULL) {
+			buffer_cache_read (block, &sector, idx * sizeof sector,
+					sizeof sector);
+			return sector;
+		}
+		buffer_cache_read (block, cache->ptrs, 0, DISK_SECTOR_SIZE);
+		cache->sector = block;
+	}
+	return cache->ptrs[idx];
+}
+
+/* Sets pointer IDX of the pointer block at BLOCK to SECTOR.  Requires
+ * INODE's lock. */
+static void
+ptr_set (struct inode *inode, int level, disk_sector_t block, size_t idx,
+		disk_sector_t sector) {
+	struct ptr_cache *cache = &inode->ptr_cache[level];
+
+	buffer_cache_write_meta (block, &sector, idx * sizeof sector,
+			sizeof sector);
+	if (cache->sector == block)
+		cache->ptrs[idx] = sector;
+}
+
+/* Returns the sector in *SLOTP, a pointer in INODE's on-disk inode.
+ * If it is a hole and CREATE is true, fills it with a new sector
+ * first, or returns 0 if the disk is full.  Requires INODE's lock. */
+static disk_sector_t
+inode_slot (struct inode *inode, disk_sector_t *slotp, bool create) {
+	if (*slotp == 0 && create && sector_alloc (inode, slotp))
+		buffer_cache_write_meta (inode->sector, &inode->data, 0,
+				DISK_SECTOR_SIZE);
+	return *slotp;
+}
+
+/* Like inode_slot(), for pointer IDX of the pointer block at BLOCK,
+ * cached at LEVEL. */
+static disk_sector_t
+block_slot (struct inode *inode, int level, disk_sector_t block, size_t idx,
+		bool create) {
+	disk_sector_t sector = ptr_get (inode, level, block, idx);
+
+	if (sector == 0 && create && sector_alloc (inode, &sector))
+		ptr_set (inode, level, block, idx, sector);
+	return sector;
+}
+
+/* Returns the disk sector that contains byte offset POS within
+ * INODE.
+ * Returns 0 if that sector is a hole, or is past the largest possible
+ * file.  If CREATE is true, a hole is filled with a new zeroed sector
+ * instead, along with the pointer blocks leading to it; 0 is then
+ * returned only if the disk is full.  Requires INODE's lock. */
+static disk_sector_t
+byte_to_sector (struct inode *inode, off_t pos, bool create) {
+	struct inode_disk *data = &inode->data;
+	size_t idx = pos / DISK_SECTOR_SIZE;
+	disk_sector_t block;
+
+	ASSERT (inode != NULL);
+	ASSERT (pos >= 0);
+
+	if (idx < DIRECT_CNT)
+		return inode_slot (inode, &data->direct[idx], create);
+	idx -= DIRECT_CNT;
+
+	if (idx < PTRS_PER_BLOCK) {
+		block = inode_slot (inode, &data->indirect, create);
+		return block != 0 ? block_slot (inode, 1, block, idx, create) : 0;
+	}
+	idx -= PTRS_PER_BLOCK;
+
+	if (idx < PTRS_PER_BLOCK * PTRS_PER_BLOCK) {
+		block = inode_slot (inode, &data->doubly_indirect, create);
+		if (block != 0)
+			block = block_slot (inode, 0, block, idx / PTRS_PER_BLOCK, create);
+		return block != 0
+			? block_slot (inode, 1, block, idx % PTRS_PER_BLOCK, create) : 0;
+	}
+	return 0;
+}
+
+/* Releases the pointer block at BLOCK and the sectors it points to,
+ * which are pointer blocks themselves if DEPTH is greater than 1. */
+static void
+block_release (disk_sector_t block, int depth) {
+	disk_sector_t *ptrs = malloc (DISK_SECTOR_SIZE);
+
+	if (ptrs != NULL) {
+		buffer_cache_read (block, ptrs, 0, DISK_SECTOR_SIZE);
+		for (size_t i = 0; i < PTRS_PER_BLOCK; i++) {
+			if (ptrs[i] == 0)
+				continue;
+			if (depth > 1)
+				block_release (ptrs[i], depth - 1);
+			else
+				free_map_release (ptrs[i], 1);
+		}
+		free (ptrs);
+	}
+	free_map_release (block, 1);
+}
+
+/* Releases all of the data sectors and pointer blocks of INODE. */
+static void
+inode_release (struct inode *inode) {
+	struct inode_disk *data = &inode->data;
+
+	for (size_t i = 0; i < DIRECT_CNT; i++)
+		if (data->direct[i] != 0)
+			free_map_release (data->direct[i], 1);
+	if (data->indirect != 0)
+		block_release (data->indirect, 1);
+	if (data->doubly_indirect != 0)
+		block_release (data->doubly_indirect, 2);
+	memset (data->direct, 0, sizeof data->direct);
+	data->indirect = data->doubly_indirect = 0;
+}
+#endif
+
+/* Fills the holes among the sectors of INODE that hold bytes OFFSET
+ * to OFFSET + SIZE.  Returns false if the disk is full.  Requires
+ * INODE's lock. */
+static bool
+inode_allocate (struct inode *inode, off_t offset, off_t size) {
+	off_t pos;
+
+	if (size <= 0)
+		return true;
+	for (pos = offset - offset % DISK_SECTOR_SIZE; pos < offset + size;
+			pos += DISK_SECTOR_SIZE)
+		if (byte_to_sector (inode, pos, true) == 0)
+			return false;
+	return true;
+}
+
+/* Blocks that inode_fill() allocates in a single operation, so that
+ * it changes no more than JOURNAL_OP_MAX sectors. */
+#define FILL_STEP 8
+
+/* Fills the holes among the sectors of INODE that hold the SIZE bytes
+ * at OFFSET, FILL_STEP blocks per operation.  Returns false if the
+ * disk is full; the sectors allocated until then are kept.  Begins
+ * operations, so it must not be called with a lock of the file system
+ * held. */
+bool
+inode_fill (struct inode *inode, off_t size, off_t offset) {
+	off_t pos = offset - offset % BLOCK_SIZE;
+	off_t end = offset + size;
+	bool success = true;
+
+	if (size <= 0)
+		return true;
+#ifdef EFILESYS
+	/* A chain grows from its end, however far OFFSET is past it. */
+	lock_acquire (&inode->lock);
+	if (pos > (off_t) chain_length (inode) * BLOCK_SIZE)
+		pos = (off_t) chain_length (inode) * BLOCK_SIZE;
+	lock_release (&inode->lock);
+#endif
+
+	while (success && pos < end) {
+		off_t step = end - pos < FILL_STEP * BLOCK_SIZE
+			? end - pos : FILL_STEP * BLOCK_SIZE;
+
+		journal_begin ();
+		lock_acquire (&inode->lock);
+		success = inode_allocate (inode, pos, step);
+		lock_release (&inode->lock);
+		journal_end ();
+		pos += step;
+	}
+	return success;
+}
+
+/* Inodes in memory, by sector, so that opening a single inode twice
+ * returns the same `struct inode'.  Besides the open inodes, it holds
+ * the last CLOSED_INODE_MAX inodes closed, which are also in
+ * CLOSED_INODES, most recently closed first, so that opening one of
+ * them again reads nothing from disk. */
+#define CLOSED_INODE_MAX 32
+static struct hash open_inodes;
+static struct list closed_inodes;
+static size_t closed_cnt;
+
+/* Protects OPEN_INODES, CLOSED_INODES and the open counts. */
+static struct lock open_inodes_lock;
+/* Signaled when an inode being evicted is out of OPEN_INODES. */
+static struct condition inode_evicted;
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct inode *inode = hash_entry (e, struct inode, elem);
+	return hash_int (inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode, elem)->sector
+		< hash_entry (b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+		PANIC ("inode table creation failed");
+	list_init (&closed_inodes);
+	closed_cnt = 0;
+	lock_init (&open_inodes_lock);
+	cond_init (&inode_evicted);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
  * writes the new inode to sector SECTOR on the file system
- * disk.
+ * disk.  The data are left a hole, which reads as zeros; sectors
+ * are allocated as they are written.
  * Returns true if successful.
- * Returns false if memory or disk allocation fails. */
+ * Returns false if memory allocation fails. */
 bool
 inode_create (disk_sector_t sector, off_t length) {
 	struct inode_disk *disk_inode = NULL;
-	bool success = false;
 
 	ASSERT (length >= 0);
 
@@ -76,24 +517,13 @@ inode_create (disk_sector_t sector, off_t length) {
 	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
 	disk_inode = calloc (1, sizeof *disk_inode);
-	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
-		free (disk_inode);
-	}
-	return success;
+	if (disk_inode == NULL)
+		return false;
+	disk_inode->length = length;
+	disk_inode->magic = INODE_MAGIC;
+	buffer_cache_write_meta (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+	free (disk_inode);
+	return true;
 }
 
 /* Reads an inode from SECTOR
@@ -101,39 +531,70 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
+	struct inode key;
+	struct hash_elem *e;
 	struct inode *inode;
 
-	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
+	/* Check whether this inode is already open, or was closed
+	 * recently. */
+	key.sector = sector;
+	lock_acquire (&open_inodes_lock);
+	while ((e = hash_find (&open_inodes, &key.elem)) != NULL
+			&& hash_entry (e, struct inode, elem)->evicting)
+		cond_wait (&inode_evicted, &open_inodes_lock);
+	if (e != NULL) {
+		inode = hash_entry (e, struct inode, elem);
+		if (inode->open_cnt++ == 0) {
+			list_remove (&inode->lru_elem);
+			closed_cnt--;
 		}
+		lock_release (&open_inodes_lock);
+		return inode;
 	}
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	if (inode == NULL) {
+		lock_release (&open_inodes_lock);
 		return NULL;
+	}
 
 	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
 	inode->sector = sector;
 	inode->open_cnt = 1;
+	inode->evicting = false;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->metadata = sector == FREE_MAP_SECTOR;
+#ifdef VM
+	list_init (&inode->pages);
+#endif
+	rwlock_init (&inode->rw);
+	lock_init (&inode->dir_lock);
+	lock_init (&inode->lock);
+#ifdef EFILESYS
+	chain_forget (inode);
+#else
+	for (int i = 0; i < 2; i++) {
+		inode->ptr_cache[i].sector = 0;
+		inode->ptr_cache[i].ptrs = NULL;
+	}
+	inode->alloc_goal = sector + 1;
+#endif
+	buffer_cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	hash_insert (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
@@ -143,29 +604,66 @@ inode_get_inumber (const struct inode *inode) {
 	return inode->sector;
 }
 
+/* Frees INODE, which is no longer in OPEN_INODES, and its blocks
+ * if it was removed. */
+static void
+inode_free (struct inode *inode) {
+	/* Deallocate blocks if removed. */
+	if (inode->removed) {
+#ifdef VM
+		page_cache_drop (inode, false);
+#endif
+		inode_sector_release (inode->sector);
+		inode_release (inode);
+	}
+
+#ifndef EFILESYS
+	free (inode->ptr_cache[0].ptrs);
+	free (inode->ptr_cache[1].ptrs);
+#endif
+	free (inode);
+}
+
 /* Closes INODE and writes it to disk.
- * If this was the last reference to INODE, frees its memory.
- * If INODE was also a removed inode, frees its blocks. */
+ * If this was the last reference to INODE, keeps it among the
+ * recently closed inodes, and frees the memory of the least recently
+ * closed one if there are too many.
+ * If INODE was also a removed inode, frees its memory and blocks. */
 void
 inode_close (struct inode *inode) {
 	/* Ignore null pointer. */
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	lock_acquire (&open_inodes_lock);
+	if (--inode->open_cnt > 0) {
+		lock_release (&open_inodes_lock);
+		return;
+	}
 
-		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+	if (!inode->removed) {
+		list_push_front (&closed_inodes, &inode->lru_elem);
+		if (++closed_cnt <= CLOSED_INODE_MAX) {
+			lock_release (&open_inodes_lock);
+			return;
 		}
-
-		free (inode); 
+		inode = list_entry (list_pop_back (&closed_inodes), struct inode,
+				lru_elem);
+		closed_cnt--;
+#ifdef VM
+		/* Write back its cached data and free the pages, keeping
+		 * anyone from opening the inode anew and reading the disk
+		 * until then. */
+		inode->evicting = true;
+		lock_release (&open_inodes_lock);
+		page_cache_drop (inode, true);
+		lock_acquire (&open_inodes_lock);
+		cond_broadcast (&inode_evicted, &open_inodes_lock);
+#endif
 	}
+	hash_delete (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+	inode_free (inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -180,101 +678,167 @@ inode_remove (struct inode *inode) {
  * Returns the number of bytes actually read, which may be less
  * than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) {
+	off_t bytes_read;
+
+	rwlock_acquire_read (&inode->rw);
+#ifdef VM
+	if (!inode->metadata)
+		bytes_read = page_cache_read (inode, buffer, size, offset);
+	else
+#endif
+		bytes_read = inode_read_direct (inode, buffer, size, offset);
+	rwlock_release_read (&inode->rw);
+	return bytes_read;
+}
+
+/* Like inode_read_at(), but bypasses the page cache and reads through
+ * the buffer cache. */
+off_t
+inode_read_direct (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
-		/* Bytes left in inode, bytes left in sector, lesser of the two. */
+		/* Bytes left in inode, bytes left in block, lesser of the two. */
 		off_t inode_left = inode_length (inode) - offset;
-		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-		int min_left = inode_left < sector_left ? inode_left : sector_left;
+		int block_left = BLOCK_SIZE - offset % BLOCK_SIZE;
+		int min_left = inode_left < block_left ? inode_left : block_left;
 
-		/* Number of bytes to actually copy out of this sector. */
+		/* Number of bytes to actually copy out of this block. */
 		int chunk_size = size < min_left ? size : min_left;
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		lock_acquire (&inode->lock);
+		sector_idx = byte_to_sector (inode, offset, false);
+		lock_release (&inode->lock);
+		if (sector_idx != 0)
+			buffer_cache_read (sector_idx, buffer + bytes_read, sector_ofs,
+					chunk_size);
+		else
+			memset (buffer + bytes_read, 0, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if an error occurs.  A write past end of file
+ * extends the inode; the bytes skipped over, if any, read as
+ * zeros. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
 		off_t offset) {
-	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
-	if (inode->deny_write_cnt)
+	/* Allocate the sectors written to first, a few per operation, so
+	 * that the operation that writes them changes little else. */
+	if (!inode_fill (inode, size, offset))
 		return 0;
 
+	journal_begin ();
+	rwlock_acquire_write (&inode->rw);
+	lock_acquire (&inode->lock);
+	if (inode->deny_write_cnt) {
+		lock_release (&inode->lock);
+		goto done;
+	}
+
+	/* Extend the file before writing, so that no part of the data is
+	 * past its end. */
+	if (offset + size > inode->data.length) {
+		inode->data.length = offset + size;
+		buffer_cache_write_meta (inode->sector, &inode->data, 0,
+				DISK_SECTOR_SIZE);
+	}
+	lock_release (&inode->lock);
+
+#ifdef VM
+	/* Metadata does not go through the page cache, so that it is
+	 * written through the journal as its operation changes it.  The
+	 * free map is also written while sectors are allocated for pages
+	 * being written back. */
+	if (!inode->metadata)
+		bytes_written = page_cache_write (inode, buffer, size, offset);
+	else
+#endif
+		bytes_written = inode_write_direct (inode, buffer, size, offset);
+
+done:
+	rwlock_release_write (&inode->rw);
+	journal_end ();
+	return bytes_written;
+}
+
+/* Like inode_write_at(), but bypasses the page cache, writing through
+ * the buffer cache, or through the journal for metadata, and ignores
+ * inode_deny_write(). */
+off_t
+inode_write_direct (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t bytes_written = 0;
+	uint8_t *bounce = NULL;
+	void (*write_sector) (disk_sector_t, const void *, int, int)
+		= inode->metadata ? buffer_cache_write_meta : buffer_cache_write;
+
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
-		/* Bytes left in inode, bytes left in sector, lesser of the two. */
+		/* Bytes left in inode, bytes left in block, lesser of the two. */
 		off_t inode_left = inode_length (inode) - offset;
-		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-		int min_left = inode_left < sector_left ? inode_left : sector_left;
+		int block_left = BLOCK_SIZE - offset % BLOCK_SIZE;
+		int min_left = inode_left < block_left ? inode_left : block_left;
 
-		/* Number of bytes to actually write into this sector. */
+		/* Number of bytes to actually write into this block, and of
+		 * those, the ones in a last sector that they start and the end
+		 * of file ends. */
 		int chunk_size = size < min_left ? size : min_left;
+		int tail_size = 0;
 		if (chunk_size <= 0)
 			break;
+		if (chunk_size == inode_left
+				&& (sector_ofs + chunk_size) % DISK_SECTOR_SIZE <= chunk_size)
+			tail_size = (sector_ofs + chunk_size) % DISK_SECTOR_SIZE;
+
+		/* Fill a hole left by inode_create() or by a store through
+		 * mmap(), when a page is written back. */
+		lock_acquire (&inode->lock);
+		sector_idx = byte_to_sector (inode, offset, true);
+		lock_release (&inode->lock);
+		if (sector_idx == 0)
+			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
+		write_sector (sector_idx, buffer + bytes_written, sector_ofs,
+				chunk_size - tail_size);
+		if (tail_size > 0) {
+			/* The rest of the sector is past the end of file and
+			   need not be kept, so write it as zeros instead of
+			   reading it in.  We need a bounce buffer. */
 			if (bounce == NULL) {
 				bounce = malloc (DISK_SECTOR_SIZE);
 				if (bounce == NULL)
 					break;
 			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
+			memset (bounce, 0, DISK_SECTOR_SIZE);
+			memcpy (bounce, buffer + bytes_written + chunk_size - tail_size,
+					tail_size);
+			write_sector (sector_idx, bounce,
+					sector_ofs + chunk_size - tail_size, DISK_SECTOR_SIZE);
 		}
 
 		/* Advance. */
@@ -287,13 +851,37 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	return bytes_written;
 }
 
+/* Writes the SIZE bytes of INODE's data at OFFSET that the buffer
+ * cache holds modified to the disk.  Data still in the page cache is
+ * not written. */
+void
+inode_flush (struct inode *inode, off_t size, off_t offset) {
+	off_t end = offset + size;
+	off_t length = inode_length (inode);
+
+	if (end > length)
+		end = length;
+	for (offset -= offset % DISK_SECTOR_SIZE; offset < end;
+			offset += DISK_SECTOR_SIZE) {
+		disk_sector_t sector_idx;
+
+		lock_acquire (&inode->lock);
+		sector_idx = byte_to_sector (inode, offset, false);
+		lock_release (&inode->lock);
+		if (sector_idx != 0)
+			buffer_cache_flush_sector (sector_idx);
+	}
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
 inode_deny_write (struct inode *inode) 
 {
+	lock_acquire (&inode->lock);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -301,9 +889,30 @@ inode_deny_write (struct inode *inode)
  * inode_deny_write() on the inode, before closing the inode. */
 void
 inode_allow_write (struct inode *inode) {
+	lock_acquire (&inode->lock);
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	lock_release (&inode->lock);
+}
+
+/* Marks INODE as holding a directory, whose contents are metadata. */
+void
+inode_mark_metadata (struct inode *inode) {
+	inode->metadata = true;
+}
+
+/* Locks the directory held by INODE, for searching or changing it as
+ * a whole. */
+void
+inode_lock_dir (struct inode *inode) {
+	lock_acquire (&inode->dir_lock);
+}
+
+/* Unlocks the directory held by INODE. */
+void
+inode_unlock_dir (struct inode *inode) {
+	lock_release (&inode->dir_lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -311,3 +920,11 @@ off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
 }
+
+#ifdef VM
+/* Returns the list of INODE's pages in the page cache. */
+struct list *
+inode_cached_pages (struct inode *inode) {
+	return &inode->pages;
+}
+#endif
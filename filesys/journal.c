@@ -0,0 +1,302 @@
+/* journal.c: Write-ahead journal of file system metadata.
+ *
+ * Inodes, pointer blocks, directories, the free map and the FAT are
+ * metadata.  A write to a metadata sector is not written in place by
+ * the buffer cache; a copy of the sector is kept in the running
+ * transaction instead, and the buffer cache reads it back from there
+ * if it drops the sector.  The transaction is committed by writing its
+ * sectors one after another into the journal region, followed by a
+ * header that lists their home sectors, and only then are they written
+ * in place.  At boot, a committed transaction whose header is still in
+ * the journal is written in place again, so that a crash leaves the
+ * metadata as it was before or after the commit, not in between.
+ *
+ * Changes made by many operations are committed together: by
+ * jcommitd, when the journal has no room left for another operation,
+ * and when the file system is shut down.  An operation that changes
+ * metadata is enclosed between journal_begin() and journal_end(), so
+ * that a commit takes all of its changes or none of them.  It begins
+ * only once the journal has room for all of them, so that the journal
+ * never fills in the middle of one. */
+
+#include "filesys/journal.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Sectors a transaction holds: all of the journal but its header. */
+#define JOURNAL_MAX (JOURNAL_SECTORS - 1)
+/* How often jcommitd commits. */
+#define COMMIT_INTERVAL (5 * TIMER_FREQ)
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Header of the journal, in its first sector.  The CNT sectors that
+ * follow it hold the contents of SECTORS.  CNT is 0 unless a
+ * transaction was committed but not yet written in place. */
+struct journal_header {
+	uint32_t magic;                     /* JOURNAL_MAGIC. */
+	uint32_t cnt;                       /* Sectors in the transaction. */
+	disk_sector_t sectors[JOURNAL_MAX]; /* Home sectors. */
+	uint32_t unused[DISK_SECTOR_SIZE / sizeof (uint32_t) - 2 - JOURNAL_MAX];
+};
+
+/* The running transaction: the home sectors in HEADER, and their
+ * contents in the slots of DATA. */
+static struct journal_header header;
+static uint8_t *data;
+
+/* Operations between journal_begin() and journal_end(). */
+static int active_cnt;
+/* A commit is waiting for the operations to end, or running. */
+static bool committing;
+
+/* Protects the transaction, ACTIVE_CNT and COMMITTING.  Acquired after
+ * the lock of a buffer in the buffer cache. */
+static struct lock journal_lock;
+/* Signaled when an operation ends or a commit finishes. */
+static struct condition journal_changed;
+
+static void jcommitd (void *aux UNUSED);
+
+/* Returns the contents of slot I of the transaction. */
+static uint8_t *
+slot_data (size_t i) {
+	return data + i * DISK_SECTOR_SIZE;
+}
+
+/* Returns the slot of SECTOR in the transaction, or -1 if it has
+ * none.  Requires journal_lock. */
+static int
+slot_find (disk_sector_t sector) {
+	for (size_t i = 0; i < header.cnt; i++)
+		if (header.sectors[i] == sector)
+			return i;
+	return -1;
+}
+
+/* Returns true if the running transaction has room for OP_CNT
+ * operations, besides the sectors of the free map or the FAT in which
+ * a sector was allocated, which are committed with it.  Requires
+ * journal_lock. */
+static bool
+has_room (int op_cnt) {
+#ifdef EFILESYS
+	size_t alloc_cnt = fat_allocated_cnt ();
+#else
+	size_t alloc_cnt = free_map_allocated_cnt ();
+#endif
+
+	return header.cnt + alloc_cnt + op_cnt * JOURNAL_OP_MAX <= JOURNAL_MAX;
+}
+
+/* Writes the transaction to the journal, then in place, and empties
+ * it.  Requires journal_lock. */
+static void
+commit_transaction (void) {
+	size_t cnt = header.cnt;
+
+	if (cnt == 0)
+		return;
+
+	/* Write the sectors, then the header that commits them. */
+	for (size_t i = 0; i < cnt; i++)
+		disk_write (filesys_disk, JOURNAL_SECTOR + 1 + i, slot_data (i));
+	disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+
+	/* Write them in place, and mark the journal empty. */
+	for (size_t i = 0; i < cnt; i++)
+		disk_write (filesys_disk, header.sectors[i], slot_data (i));
+	header.cnt = 0;
+	disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+}
+
+/* Writes in place the transaction committed in the journal, if any.
+ * If FORMAT is true, the journal is only emptied. */
+static void
+replay (bool format) {
+	disk_read (filesys_disk, JOURNAL_SECTOR, &header);
+	if (!format && header.magic == JOURNAL_MAGIC
+			&& header.cnt <= JOURNAL_MAX) {
+		for (size_t i = 0; i < header.cnt; i++) {
+			disk_read (filesys_disk, JOURNAL_SECTOR + 1 + i, data);
+			disk_write (filesys_disk, header.sectors[i], data);
+		}
+	}
+	memset (&header, 0, sizeof header);
+	header.magic = JOURNAL_MAGIC;
+	disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+}
+
+/* Initializes the journal, replaying a transaction left committed in
+ * it unless FORMAT is true.  Must be called before metadata is read
+ * through the buffer cache. */
+void
+journal_init (bool format) {
+	ASSERT (sizeof header == DISK_SECTOR_SIZE);
+
+	data = palloc_get_multiple (PAL_ASSERT,
+			DIV_ROUND_UP (JOURNAL_MAX * DISK_SECTOR_SIZE, PGSIZE));
+	lock_init (&journal_lock);
+	cond_init (&journal_changed);
+	active_cnt = 0;
+	committing = false;
+	replay (format);
+	thread_create ("jcommitd", PRI_DEFAULT, jcommitd, NULL);
+}
+
+/* Begins an operation that changes metadata.  Waits for a commit that
+ * is running, and commits first if the journal has no room left for
+ * the operation.  Operations nest; only the outermost one counts. */
+void
+journal_begin (void) {
+	struct thread *t = thread_current ();
+
+	if (t->journal_depth++ > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	for (;;) {
+		if (!committing && has_room (active_cnt + 1))
+			break;
+		if (committing || active_cnt > 0)
+			cond_wait (&journal_changed, &journal_lock);
+		else {
+			lock_release (&journal_lock);
+			journal_commit ();
+			lock_acquire (&journal_lock);
+		}
+	}
+	active_cnt++;
+	lock_release (&journal_lock);
+}
+
+/* Ends an operation begun by journal_begin().  If it was the last one
+ * running and left no room for another, commits. */
+void
+journal_end (void) {
+	struct thread *t = thread_current ();
+	bool full;
+
+	ASSERT (t->journal_depth > 0);
+	if (--t->journal_depth > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	active_cnt--;
+	full = active_cnt == 0 && !committing && !has_room (1);
+	cond_broadcast (&journal_changed, &journal_lock);
+	lock_release (&journal_lock);
+
+	if (full)
+		journal_commit ();
+}
+
+/* Commits the metadata changed by the operations that ended, once
+ * those running have ended.  The free map or the FAT, which is
+ * changed in memory, is written out first, so that it is committed
+ * along with the inodes that use its sectors.  Its sectors that only
+ * free others may not fit; they are committed by further
+ * transactions. */
+void
+journal_commit (void) {
+	struct thread *t = thread_current ();
+	bool done = false;
+
+	lock_acquire (&journal_lock);
+	while (committing)
+		cond_wait (&journal_changed, &journal_lock);
+	committing = true;
+	while (active_cnt > 0)
+		cond_wait (&journal_changed, &journal_lock);
+
+	while (!done) {
+		size_t room = JOURNAL_MAX - header.cnt;
+
+		/* Writing out the allocation state is part of the commit. */
+		lock_release (&journal_lock);
+		t->journal_depth++;
+#ifdef EFILESYS
+		done = fat_flush (room);
+#else
+		done = free_map_flush (room);
+#endif
+		t->journal_depth--;
+		lock_acquire (&journal_lock);
+		commit_transaction ();
+	}
+	committing = false;
+	cond_broadcast (&journal_changed, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Puts the contents of metadata SECTOR, DISK_SECTOR_SIZE bytes at
+ * BUFFER, into the running transaction.  journal_begin() left room for
+ * it, unless an operation changed more than JOURNAL_OP_MAX sectors. */
+void
+journal_log (disk_sector_t sector, const void *buffer) {
+	int slot;
+
+	lock_acquire (&journal_lock);
+	slot = slot_find (sector);
+	if (slot < 0) {
+		ASSERT (header.cnt < JOURNAL_MAX);
+		slot = header.cnt++;
+		header.sectors[slot] = sector;
+	}
+	memcpy (slot_data (slot), buffer, DISK_SECTOR_SIZE);
+	lock_release (&journal_lock);
+}
+
+/* Copies the contents of SECTOR into BUFFER if the running transaction
+ * holds it, which is then newer than the disk.  Returns true if it
+ * does, false otherwise. */
+bool
+journal_read (disk_sector_t sector, void *buffer) {
+	int slot;
+
+	lock_acquire (&journal_lock);
+	slot = slot_find (sector);
+	if (slot >= 0)
+		memcpy (buffer, slot_data (slot), DISK_SECTOR_SIZE);
+	lock_release (&journal_lock);
+	return slot >= 0;
+}
+
+/* Drops SECTOR from the running transaction, because it was freed and
+ * is now written in place as file data, which a later commit must not
+ * overwrite. */
+void
+journal_forget (disk_sector_t sector) {
+	int slot;
+
+	lock_acquire (&journal_lock);
+	slot = slot_find (sector);
+	if (slot >= 0) {
+		size_t last = --header.cnt;
+
+		if ((size_t) slot != last) {
+			header.sectors[slot] = header.sectors[last];
+			memcpy (slot_data (slot), slot_data (last), DISK_SECTOR_SIZE);
+		}
+	}
+	lock_release (&journal_lock);
+}
+
+/* Commits the metadata changed recently. */
+static void
+jcommitd (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (COMMIT_INTERVAL);
+		journal_commit ();
+	}
+}
@@ -1,50 +1,171 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
+/* page_cache.c: Implementation of Page Cache (Buffer Cache).
+ *
+ * With VM, file data is read and written through the page cache, a page
+ * at a time, instead of going to the disk for every sector.  The cached
+ * pages are the data entries of the shared frame index (vm/share.c), so
+ * a page of a file has one frame, whether it is reached through read()
+ * and write() or mapped by mmap(), and the clock algorithm reclaims
+ * cached pages along with everything else.
+ *
+ * A read that misses right after the page before it was cached reads
+ * the next pages as well.  With FAT clusters bigger than a page, a read
+ * that misses reads the rest of the cluster too.  Writes only dirty the
+ * cache; kworkerd writes pages back once they have been dirty for a
+ * while, and writers write back the oldest ones themselves when too
+ * many are dirty. */
 
-#include "vm/vm.h"
-static bool page_cache_readahead (struct page *page, void *kva);
-static bool page_cache_writeback (struct page *page);
-static void page_cache_destroy (struct page *page);
+#include "filesys/page_cache.h"
+#ifdef VM
+#include <stdint.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/share.h"
 
-/* DO NOT MODIFY this struct */
-static const struct page_operations page_cache_op = {
-	.swap_in = page_cache_readahead,
-	.swap_out = page_cache_writeback,
-	.destroy = page_cache_destroy,
-	.type = VM_PAGE_CACHE,
-};
+/* Pages read ahead of a sequential read that misses. */
+#define READAHEAD_PAGES 4
+/* How often kworkerd wakes up, and how long a page may stay dirty. */
+#define KWORKERD_INTERVAL (5 * TIMER_FREQ)
+#define DIRTY_EXPIRE (30 * TIMER_FREQ)
+/* Dirty pages beyond which writers write back down to half as many. */
+#define DIRTY_LIMIT 64
+
+static void page_cache_kworkerd (void *aux UNUSED);
+
+/* Until the page cache is set up, in particular while the file system
+ * is formatted, inodes are read and written directly. */
+static bool page_cache_ready;
 
 tid_t page_cache_workerd;
 
 /* The initializer of file vm */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	page_cache_ready = true;
+	page_cache_workerd = thread_create ("kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+}
+
+/* Reads the pages of INODE after the one at page-aligned OFS into the
+ * cache, up to READAHEAD_PAGES of them and the end of file. */
+static void
+page_cache_readahead (struct inode *inode, off_t ofs) {
+	off_t length = inode_length (inode);
+
+	for (int i = 1; i <= READAHEAD_PAGES; i++) {
+		if (ofs + i * PGSIZE >= length)
+			break;
+		share_cache_fetch (inode, ofs + i * PGSIZE);
+	}
+}
+
+#ifdef EFILESYS
+/* Reads the other pages of the cluster that holds the page at
+ * page-aligned OFS of INODE into the cache, up to the end of file. */
+static void
+page_cache_fill_cluster (struct inode *inode, off_t ofs) {
+	off_t cluster_size = (off_t) fat_cluster_sectors () * DISK_SECTOR_SIZE;
+	off_t start = ofs - ofs % cluster_size;
+	off_t length = inode_length (inode);
+
+	for (off_t page = start; page < start + cluster_size && page < length;
+			page += PGSIZE)
+		if (page != ofs)
+			share_cache_fetch (inode, page);
 }
+#endif
 
-/* Initialize the page cache */
-bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
-	/* Set up the handler */
-	page->operations = &page_cache_op;
+/* Copies SIZE bytes between BUFFER and INODE at OFFSET, through the
+ * page cache, as inode_read_at() and inode_write_at() do.  Returns the
+ * number of bytes copied. */
+static off_t
+page_cache_rw (struct inode *inode, uint8_t *buffer, off_t size,
+		off_t offset, bool write) {
+	off_t length = inode_length (inode);
+	off_t bytes_done = 0;
 
+	while (size > 0 && offset < length) {
+		/* Page to copy, starting byte offset within page. */
+		int page_ofs = offset % PGSIZE;
+		off_t page = offset - page_ofs;
+
+		/* Bytes left in inode, bytes left in page, lesser of the two. */
+		off_t inode_left = length - offset;
+		int page_left = PGSIZE - page_ofs;
+		int min_left = inode_left < page_left ? inode_left : page_left;
+
+		/* Number of bytes to actually copy within this page. */
+		int chunk_size = size < min_left ? size : min_left;
+		bool hit;
+
+		if (!share_cache_rw (inode, offset, buffer + bytes_done, chunk_size,
+					write, &hit))
+			break;
+		if (!write && !hit) {
+#ifdef EFILESYS
+			page_cache_fill_cluster (inode, page);
+#endif
+			if (page > 0 && share_cached (inode, page - PGSIZE))
+				page_cache_readahead (inode, page);
+		}
+
+		/* Advance. */
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_done += chunk_size;
+	}
+	return bytes_done;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at OFFSET, through
+ * the page cache. */
+off_t
+page_cache_read (struct inode *inode, void *buffer, off_t size,
+		off_t offset) {
+	if (!page_cache_ready)
+		return inode_read_direct (inode, buffer, size, offset);
+	return page_cache_rw (inode, buffer, size, offset, false);
 }
 
-/* Utilze the Swap in mechanism to implement readhead */
-static bool
-page_cache_readahead (struct page *page, void *kva) {
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET, into
+ * the page cache. */
+off_t
+page_cache_write (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	off_t bytes_written;
+
+	if (!page_cache_ready)
+		return inode_write_direct (inode, buffer, size, offset);
+	bytes_written = page_cache_rw (inode, (uint8_t *) buffer, size, offset,
+			true);
+	if (share_dirty_cnt () > DIRTY_LIMIT)
+		share_writeback (INT64_MAX, DIRTY_LIMIT / 2);
+	return bytes_written;
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
-static bool
-page_cache_writeback (struct page *page) {
+/* Frees INODE's pages in the page cache when it is closed for the last
+ * time, writing back their dirty data first if WRITE_BACK. */
+void
+page_cache_drop (struct inode *inode, bool write_back) {
+	if (page_cache_ready)
+		share_cache_drop (inode, write_back);
 }
 
-/* Destory the page_cache. */
-static void
-page_cache_destroy (struct page *page) {
+/* Writes back every dirty page in the page cache. */
+void
+page_cache_flush (void) {
+	if (page_cache_ready)
+		share_writeback (0, 0);
 }
 
 /* Worker thread for page cache */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (KWORKERD_INTERVAL);
+		share_writeback (DIRTY_EXPIRE, SIZE_MAX);
+	}
 }
+#endif /* VM */
@@ -0,0 +1,15 @@
+#ifndef FILESYS_BUFFER_CACHE_H
+#define FILESYS_BUFFER_CACHE_H
+
+#include "devices/disk.h"
+
+void buffer_cache_init (void);
+void buffer_cache_read (disk_sector_t, void *, int sector_ofs, int size);
+void buffer_cache_write (disk_sector_t, const void *, int sector_ofs,
+		int size);
+void buffer_cache_write_meta (disk_sector_t, const void *, int sector_ofs,
+		int size);
+void buffer_cache_flush (void);
+void buffer_cache_flush_sector (disk_sector_t);
+
+#endif /* filesys/buffer_cache.h */
@@ -14,15 +14,20 @@ typedef uint32_t cluster_t;  /* Index of a cluster within FAT. */
 #define EOChain 0x0FFFFFFF   /* End of cluster chain */
 
 /* Sectors of FAT information. */
-#define SECTORS_PER_CLUSTER 1 /* Number of sectors per cluster */
+#define MAX_SECTORS_PER_CLUSTER 64 /* Largest cluster, in sectors */
 #define FAT_BOOT_SECTOR 0     /* FAT boot sector. */
 #define ROOT_DIR_CLUSTER 1    /* Cluster for the root directory */
 
+/* -o: Sectors per cluster of a newly formatted disk, or 0 to choose
+ * by the size of the disk. */
+extern unsigned int fat_format_cluster_sectors;
+
 void fat_init (void);
 void fat_open (void);
 void fat_close (void);
 void fat_create (void);
-void fat_close (void);
+bool fat_flush (size_t max);
+size_t fat_allocated_cnt (void);
 
 cluster_t fat_create_chain (
     cluster_t clst /* Cluster # to stretch, 0: Create a new chain */
@@ -34,5 +39,7 @@ void fat_remove_chain (
 cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
+cluster_t sector_to_cluster (disk_sector_t sector);
+unsigned int fat_cluster_sectors (void);
 
 #endif /* filesys/fat.h */
@@ -6,8 +6,11 @@
 #include "devices/disk.h"
 
 struct bitmap;
+struct list;
 
 void inode_init (void);
+bool inode_sector_allocate (disk_sector_t goal, disk_sector_t *);
+void inode_sector_release (disk_sector_t);
 bool inode_create (disk_sector_t, off_t);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -16,8 +19,19 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_direct (struct inode *, void *, off_t size, off_t offset);
+off_t inode_write_direct (struct inode *, const void *, off_t size,
+		off_t offset);
+void inode_flush (struct inode *, off_t size, off_t offset);
+bool inode_fill (struct inode *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+void inode_mark_metadata (struct inode *);
+void inode_lock_dir (struct inode *);
+void inode_unlock_dir (struct inode *);
 off_t inode_length (const struct inode *);
+#ifdef VM
+struct list *inode_cached_pages (struct inode *);
+#endif
 
 #endif /* filesys/inode.h */
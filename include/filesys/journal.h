@@ -0,0 +1,37 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* First sector of the journal region, and its length in sectors. */
+#ifdef EFILESYS
+#define JOURNAL_SECTOR 1        /* After the FAT boot sector. */
+#else
+#define JOURNAL_SECTOR 2        /* After the system file inodes. */
+#endif
+#define JOURNAL_SECTORS 64
+
+/* Sectors that a single operation changes at most, counting those of
+ * the free map or the FAT in which it allocates, which are written as
+ * it commits.  An operation begins only if this many are left for it
+ * in the journal.
+ *
+ * Growing a file changes the most, and inode_write_at() grows a file
+ * 8 sectors per operation to stay within this.  That changes the
+ * inode, the indirect block, the doubly indirect block and two of its
+ * second-level blocks (5), and may allocate 3 of those pointer blocks
+ * besides the 8 data sectors, in as many sectors of the free map (11);
+ * that is 16.  With FAT, 8 clusters change the inode and 9 FAT
+ * sectors at most. */
+#define JOURNAL_OP_MAX 16
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_commit (void);
+void journal_log (disk_sector_t, const void *);
+bool journal_read (disk_sector_t, void *);
+void journal_forget (disk_sector_t);
+
+#endif /* filesys/journal.h */
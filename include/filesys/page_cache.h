@@ -1,12 +1,19 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
+#include <stdbool.h>
+#include "filesys/off_t.h"
 
-struct page;
-enum vm_type;
+struct inode;
 
+/* Cached file pages are entries of the shared frame index (vm/share.c)
+ * rather than pages of an address space, so they need no per-page
+ * data here. */
 struct page_cache {};
 
-void page_cache_init (void);
-bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+void pagecache_init (void);
+off_t page_cache_read (struct inode *, void *, off_t size, off_t offset);
+off_t page_cache_write (struct inode *, const void *, off_t size,
+		off_t offset);
+void page_cache_drop (struct inode *, bool write_back);
+void page_cache_flush (void);
 #endif
@@ -1,6 +1,8 @@
 #ifndef __LIB_SYSCALL_NR_H
 #define __LIB_SYSCALL_NR_H
 
+#include <stdint.h>
+
 /* System call numbers. */
 enum {
 	/* Projects 2 and later. */
@@ -36,6 +38,42 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra for Project 3 */
+	SYS_MADVISE,                /* Give advice about use of memory. */
+	SYS_GETRUSAGE,              /* Report resource usage. */
+	SYS_MSYNC,                  /* Write back a memory mapping. */
+	SYS_MEMLIMIT,               /* Limit resident memory. */
+};
+
+/* Advice for SYS_MADVISE. */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_RANDOM 1           /* Expect random page references. */
+#define MADV_SEQUENTIAL 2       /* Expect sequential page references. */
+#define MADV_WILLNEED 3         /* Will need these pages soon. */
+#define MADV_DONTNEED 4         /* Don't need these pages. */
+
+/* Flags for SYS_MSYNC. */
+#define MS_ASYNC 1              /* Start write-back and return. */
+#define MS_SYNC 4               /* Return when write-back is done. */
+
+/* Reclaim priorities for SYS_MEMLIMIT.  Pages of processes with lower
+   priority are evicted first. */
+#define RECLAIM_PRIO_MIN 0
+#define RECLAIM_PRIO_DEFAULT 2
+#define RECLAIM_PRIO_MAX 4
+
+/* Resource usage of a process, filled in by SYS_GETRUSAGE. */
+struct rusage {
+	uint64_t anon_pages;        /* Resident anonymous pages. */
+	uint64_t file_pages;        /* Resident file-backed pages. */
+	uint64_t swap_pages;        /* Anonymous pages in swap. */
+	uint64_t pt_pages;          /* Pages holding the page tables. */
+	uint64_t minor_faults;      /* Page faults served without I/O. */
+	uint64_t major_faults;      /* Page faults that read from disk. */
+	uint64_t cow_breaks;        /* Shared pages copied on write. */
+	uint64_t read_bytes;        /* Bytes returned by read(). */
+	uint64_t write_bytes;       /* Bytes accepted by write(). */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <syscall-nr.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -37,10 +38,14 @@ unsigned tell (int fd);
 void close (int fd);
 
 int dup2(int oldfd, int newfd);
+int getrusage (struct rusage *usage);
 
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int madvise (void *addr, size_t length, int advice);
+int msync (void *addr, size_t length, int flags);
+int memlimit (size_t max_pages, int reclaim_prio);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -78,4 +83,12 @@ get_fs_disk_write_cnt (void) {
 	return write_cnt;
 }
 
+static inline long long
+get_page_fault_cnt (void) {
+	long long fault_cnt;
+	asm volatile ("int $0x45");
+	asm volatile ("\t movq %%rax, %0": "=r" (fault_cnt));
+	return fault_cnt;
+}
+
 #endif /* lib/user/syscall.h */
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #ifdef VM
@@ -117,8 +118,12 @@ struct thread {
 
 	struct semaphore wait_sema;
 	struct semaphore free_sema;
+	struct list_elem reap_elem;	// reaper의 정리 대기열 원소
+	struct semaphore reap_sema;	// reaper가 주소 공간과 FDT 정리를 마치면 up
 
 	struct file *running;	// 이 스레드에서 실행시키고있는 파일
+	struct rusage rusage;	// fault, read/write 누적치 (getrusage)
+	int journal_depth;	// 중첩된 journal_begin() 호출 수
 
 	// int stdin_count;
 	// int stdout_count;
@@ -130,6 +135,12 @@ struct thread {
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	struct list mmap_list;              /* Regions created by mmap(). */
+	void *user_rsp;                     /* User rsp at syscall entry. */
+	size_t page_ins;                    /* Pages read from disk. */
+	size_t rss;                         /* Evictable frames of its own. */
+	size_t rss_limit;                   /* Most such frames, or 0. */
+	int reclaim_prio;                   /* RECLAIM_PRIO_MIN...MAX. */
 #endif
 
 	/* Owned by thread.c. */
@@ -11,5 +11,9 @@ void process_exit (void);
 void process_activate (struct thread *next);
 
 struct thread *get_child_with_pid(int pid);
+void process_get_rusage(struct rusage *usage);
+
+/* 종료할 때 자원 사용량을 출력할지 여부 (-rusage) */
+extern bool process_print_rusage;
 
 #endif /* userprog/process.h */
@@ -1,13 +1,31 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <hash.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
 struct anon_page {
+	size_t swap_slot;            /* Swap slot holding the page, if any. */
+
+	/* What the page was allocated with, so that MADV_DONTNEED can make
+	 * it read as it did at first: a data segment page from the
+	 * executable, any other one as zeros.  AUX is owned by the page. */
+	enum vm_type type;           /* Type, with its markers. */
+	vm_initializer *init;        /* Initializer, or a null pointer. */
+	void *aux;                   /* Its argument. */
+
+	/* Used by the same-page merging daemon (vm/ksm.c). */
+	struct ksm_frame *ksm;       /* Merged frame mapped by this page. */
+	struct hash_elem unstable_elem; /* Element in the unstable table. */
+	bool unstable;               /* In the unstable table? */
+	uint64_t checksum;           /* Contents hash at the last scan. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_is_swapped (struct page *page);
 
 #endif
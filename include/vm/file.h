@@ -1,5 +1,6 @@
 #ifndef VM_FILE_H
 #define VM_FILE_H
+#include <list.h>
 #include "filesys/file.h"
 #include "vm/vm.h"
 
@@ -7,6 +8,30 @@ struct page;
 enum vm_type;
 
 struct file_page {
+	struct file *file;           /* Backing file. */
+	off_t ofs;                   /* Offset of the page's data in FILE. */
+	size_t read_bytes;           /* Bytes from FILE; the rest is zero. */
+	struct mmap_region *region;  /* mmap() region, or NULL. */
+
+	/* Used by pages of the shared frame index (vm/share.c). */
+	struct share_entry *share;   /* Entry mapped by this page, if any. */
+};
+
+/* A region of a process's address space created by mmap(). */
+struct mmap_region {
+	struct list_elem elem;       /* Element in thread's mmap_list. */
+	void *addr;                  /* First mapped page. */
+	size_t page_cnt;             /* Number of mapped pages. */
+	struct file *file;           /* Reopened file backing the region. */
+	int advice;                  /* MADV_NORMAL, _RANDOM or _SEQUENTIAL. */
+};
+
+/* Describes where a lazily loaded segment page takes its contents
+ * from.  Passed as AUX to lazy_load_segment(). */
+struct lazy_load_arg {
+	struct file *file;           /* File to read from. */
+	off_t ofs;                   /* Offset in FILE. */
+	size_t read_bytes;           /* Bytes to read; the rest is zeroed. */
 };
 
 void vm_file_init (void);
@@ -14,4 +39,7 @@ bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+int do_msync (void *addr, size_t length, int flags);
+struct mmap_region *mmap_inherit_region (struct mmap_region *parent);
+struct mmap_region *mmap_find_region (void *va);
 #endif
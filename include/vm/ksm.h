@@ -0,0 +1,20 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct frame;
+struct page;
+
+/* Tunables, set from the kernel command line. */
+extern size_t ksm_pages_to_scan;
+extern unsigned ksm_sleep_millisecs;
+
+void ksm_init (void);
+bool ksm_handle_wp (struct page *page);
+bool ksm_try_evict (struct frame *frame);
+struct frame *ksm_detach_page (struct page *page);
+void ksm_wait (void);
+void ksm_print_stats (void);
+
+#endif /* vm/ksm.h */
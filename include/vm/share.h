@@ -0,0 +1,28 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+struct inode;
+struct mmap_region;
+struct page;
+
+void share_init (void);
+bool share_alloc_page (void *upage, struct file *file, off_t ofs,
+		size_t read_bytes, bool writable, struct mmap_region *region);
+bool share_claim_page (struct page *page);
+bool share_try_evict (struct frame *frame);
+void share_sync_page (struct page *page);
+bool share_cache_rw (struct inode *inode, off_t ofs, void *buffer,
+		size_t size, bool write, bool *hit);
+bool share_cached (struct inode *inode, off_t ofs);
+void share_cache_fetch (struct inode *inode, off_t ofs);
+size_t share_dirty_cnt (void);
+void share_writeback (int64_t age, size_t limit);
+void share_cache_drop (struct inode *inode, bool write_back);
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
 #include "threads/palloc.h"
+#include "threads/synch.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -33,9 +36,20 @@ enum vm_type {
 
 struct page_operations;
 struct thread;
+struct share_entry;
+struct ksm_frame;
 
 #define VM_TYPE(type) ((type) & 7)
 
+/* Marks the pages of the user stack. */
+#define VM_STACK VM_MARKER_0
+/* Marks pages whose frame comes from the shared frame index (vm/share.c)
+ * instead of being allocated privately when the page is claimed. */
+#define VM_SHARED VM_MARKER_1
+
+/* Maximum size of the user stack. */
+#define STACK_LIMIT (1 << 20)
+
 /* The representation of "page".
  * This is kind of "parent class", which has four "child class"es, which are
  * uninit_page, file_page, anon_page, and page cache (project4).
@@ -46,6 +60,10 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;   /* Element in the supplemental page table. */
+	struct thread *owner;        /* Process whose address space holds VA. */
+	bool writable;               /* Mapped read/write for the user? */
+	struct list_elem rmap_elem;  /* Element in FRAME's rmap. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -63,6 +81,12 @@ struct page {
 struct frame {
 	void *kva;
 	struct page *page;
+	struct list_elem elem;       /* Element in the frame table. */
+	struct share_entry *share;   /* Shared frame index entry, if shared. */
+	struct ksm_frame *ksm;       /* Merged anonymous frame, if merged. */
+	int credit;                  /* Clock passes left before eviction. */
+	struct list rmap;            /* Pages mapping this frame. */
+	int pin_cnt;                 /* Pins held by system calls. */
 };
 
 /* The function table for page operations.
@@ -85,21 +109,54 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct hash pages;           /* Pages keyed by user virtual address. */
+
+	/* Held while pages are claimed or the table is changed, since
+	 * vmworkd works on the pages concurrently for MADV_WILLNEED and
+	 * MS_ASYNC. */
+	struct lock lock;
+	int worker_cnt;              /* Work queued for vmworkd, not done. */
+	struct condition worker_done; /* Signaled when some is done. */
 };
 
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
 		struct supplemental_page_table *src);
+void supplemental_page_table_unshare (struct supplemental_page_table *spt);
 void supplemental_page_table_kill (struct supplemental_page_table *spt);
 struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+/* Watermarks for background reclaim, in free user pages. */
+extern size_t vm_low_wmark;
+extern size_t vm_high_wmark;
+
 void vm_init (void);
+void vm_print_stats (void);
+struct frame *vm_get_frame (void);
+struct frame *vm_detach_frame (struct page *page);
+void vm_free_frame (struct frame *frame);
+void vm_wait_eviction (void);
+struct page *vm_isolate_next (bool *wrapped);
+bool vm_isolate_page (struct page *page);
+void vm_putback_page (struct page *page);
+void vm_protect_page (struct page *page, bool writable);
+void vm_rmap_add (struct frame *frame, struct page *page);
+void vm_rmap_remove (struct page *page);
+bool vm_rmap_accessed (struct frame *frame);
+bool vm_rmap_dirty (struct frame *frame);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
+bool vm_pin_pages (const void *addr, size_t size, bool write);
+void vm_unpin_pages (const void *addr, size_t size);
+
+/* Called by vmworkd on each page of a range queued by
+ * vm_queue_work(). */
+typedef void vm_work_func (struct page *);
+bool vm_queue_work (void *addr, size_t page_cnt, vm_work_func *func);
 
 #define vm_alloc_page(type, upage, writable) \
 	vm_alloc_page_with_initializer ((type), (upage), (writable), NULL, NULL)
@@ -107,6 +164,8 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+int vm_madvise (void *addr, size_t length, int advice);
+void vm_get_rusage (struct rusage *usage);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -273,11 +273,18 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (start <= b->bit_cnt);
 
 	if (cnt <= b->bit_cnt) {
+		/* An element with no bit set to VALUE is skipped whole. */
+		elem_type skip = value ? 0 : (elem_type) -1;
 		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
+		size_t i = start;
+		while (i <= last) {
+			if (b->bits[elem_idx (i)] == skip)
+				i = (elem_idx (i) + 1) * ELEM_BITS;
+			else if (!bitmap_contains (b, i, cnt, !value))
 				return i;
+			else
+				i++;
+		}
 	}
 	return BITMAP_ERROR;
 }
@@ -326,6 +333,23 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START to
+   FILE, where bitmap_write() would put it.  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+		size_t start, size_t cnt) {
+	off_t ofs, size;
+
+	ASSERT (start <= b->bit_cnt);
+	ASSERT (cnt <= b->bit_cnt - start);
+
+	ofs = start / CHAR_BIT;
+	size = DIV_ROUND_UP (start + cnt, CHAR_BIT) - ofs;
+	return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+		== size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,56 @@
+/* Advises MADV_DONTNEED on dirty anonymous memory, which must read
+   back as zeros, and on a mapping of large.txt, which must read back
+   the file's contents.  Both have to fault in again. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/madvise.h"
+
+#define ANON_PAGES 16
+
+static char anon[ANON_PAGES * PGSIZE] __attribute__ ((aligned (PGSIZE)));
+
+void
+test_main (void)
+{
+  size_t len, sum = 0;
+  long long faults;
+  int handle;
+  size_t i;
+
+  /* Anonymous memory. */
+  memset (anon, 0x5a, sizeof anon);
+  CHECK (madvise (anon, sizeof anon, MADV_DONTNEED) == 0,
+         "madvise MADV_DONTNEED on anonymous memory");
+  faults = get_page_fault_cnt ();
+  for (i = 0; i < sizeof anon; i += PGSIZE)
+    sum += anon[i];
+  faults = get_page_fault_cnt () - faults;
+  if (faults < ANON_PAGES)
+    fail ("%lld faults for %d dropped pages", faults, ANON_PAGES);
+  for (i = 0; i < sizeof anon; i++)
+    if (anon[i] != 0)
+      fail ("byte %zu of dropped memory is %02hhx, not 0", i, anon[i]);
+  msg ("anonymous memory reads back as zeros");
+
+  /* File mapping. */
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  len = filesize (handle);
+  CHECK (mmap (ACTUAL, len, 0, handle, 0) != MAP_FAILED, "mmap \"large.txt\"");
+  for (i = 0; i < len; i += PGSIZE)
+    sum += ACTUAL[i];
+  CHECK (madvise (ACTUAL, len, MADV_DONTNEED) == 0,
+         "madvise MADV_DONTNEED on \"large.txt\"");
+  faults = get_page_fault_cnt ();
+  sum += ACTUAL[0];
+  if (get_page_fault_cnt () == faults)
+    fail ("dropped file page did not fault in again");
+  check_mapping (handle, len);
+  msg ("mapping reads back the file");
+
+  munmap (ACTUAL);
+  close (handle);
+  (void) sum;
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(madvise-dontneed) begin
+(madvise-dontneed) madvise MADV_DONTNEED on anonymous memory
+(madvise-dontneed) anonymous memory reads back as zeros
+(madvise-dontneed) open "large.txt"
+(madvise-dontneed) mmap "large.txt"
+(madvise-dontneed) madvise MADV_DONTNEED on "large.txt"
+(madvise-dontneed) mapping reads back the file
+(madvise-dontneed) end
+madvise-dontneed: exit(0)
+EOF
+pass;
@@ -0,0 +1,46 @@
+/* Maps large.txt, advises MADV_RANDOM, and touches its pages out of
+   order.  No readahead is done, so every page faults in on demand. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/madvise.h"
+
+void
+test_main (void)
+{
+  size_t len, page_cnt, touched = 0, sum = 0;
+  long long faults;
+  int handle;
+  size_t i;
+
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  len = filesize (handle);
+  page_cnt = (len + PGSIZE - 1) / PGSIZE;
+  CHECK (mmap (ACTUAL, len, 0, handle, 0) != MAP_FAILED, "mmap \"large.txt\"");
+  CHECK (madvise (ACTUAL, len, MADV_RANDOM) == 0, "madvise MADV_RANDOM");
+
+  /* Visit every page once, in a scattered order. */
+  faults = get_page_fault_cnt ();
+  for (i = 0; i < page_cnt; i++)
+    if (i % 2 == 1)
+      {
+        sum += ACTUAL[i * PGSIZE];
+        touched++;
+      }
+  for (i = page_cnt; i-- > 0; )
+    if (i % 2 == 0)
+      {
+        sum += ACTUAL[i * PGSIZE];
+        touched++;
+      }
+  faults = get_page_fault_cnt () - faults;
+  if (faults < (long long) touched)
+    fail ("%lld faults for %zu pages read randomly", faults, touched);
+  msg ("every page faulted in on demand");
+
+  check_mapping (handle, len);
+  munmap (ACTUAL);
+  close (handle);
+  (void) sum;
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(madvise-random) begin
+(madvise-random) open "large.txt"
+(madvise-random) mmap "large.txt"
+(madvise-random) madvise MADV_RANDOM
+(madvise-random) every page faulted in on demand
+(madvise-random) end
+madvise-random: exit(0)
+EOF
+pass;
@@ -0,0 +1,37 @@
+/* Maps large.txt, advises MADV_SEQUENTIAL, and reads the mapping
+   front to back.  Readahead should bring in most of the pages
+   without a page fault. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/madvise.h"
+
+void
+test_main (void)
+{
+  size_t len, page_cnt, sum = 0;
+  long long faults;
+  int handle;
+  size_t i;
+
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  len = filesize (handle);
+  page_cnt = (len + PGSIZE - 1) / PGSIZE;
+  CHECK (mmap (ACTUAL, len, 0, handle, 0) != MAP_FAILED, "mmap \"large.txt\"");
+  CHECK (madvise (ACTUAL, len, MADV_SEQUENTIAL) == 0,
+         "madvise MADV_SEQUENTIAL");
+
+  faults = get_page_fault_cnt ();
+  for (i = 0; i < len; i += PGSIZE)
+    sum += ACTUAL[i];
+  faults = get_page_fault_cnt () - faults;
+  if (faults * 4 > (long long) page_cnt)
+    fail ("%lld faults for %zu pages read sequentially", faults, page_cnt);
+  msg ("sequential read took few faults");
+
+  check_mapping (handle, len);
+  munmap (ACTUAL);
+  close (handle);
+  (void) sum;
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(madvise-seq) begin
+(madvise-seq) open "large.txt"
+(madvise-seq) mmap "large.txt"
+(madvise-seq) madvise MADV_SEQUENTIAL
+(madvise-seq) sequential read took few faults
+(madvise-seq) end
+madvise-seq: exit(0)
+EOF
+pass;
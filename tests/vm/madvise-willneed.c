@@ -0,0 +1,46 @@
+/* Maps large.txt and advises MADV_WILLNEED, so that the pages are
+   prefetched in the background, waits until they are all resident,
+   then reads the mapping, which must take no major fault. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/madvise.h"
+
+void
+test_main (void)
+{
+  struct rusage before, usage;
+  size_t len, page_cnt, sum = 0;
+  int handle;
+  size_t i;
+
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  len = filesize (handle);
+  page_cnt = (len + PGSIZE - 1) / PGSIZE;
+  CHECK (mmap (ACTUAL, len, 0, handle, 0) != MAP_FAILED, "mmap \"large.txt\"");
+  CHECK (getrusage (&before) == 0, "getrusage");
+  CHECK (madvise (ACTUAL, len, MADV_WILLNEED) == 0, "madvise MADV_WILLNEED");
+
+  /* Wait for vmworkd to bring every page in, without touching the
+     mapping ourselves. */
+  do
+    if (getrusage (&usage) != 0)
+      fail ("getrusage failed");
+  while (usage.file_pages < before.file_pages + page_cnt);
+
+  before = usage;
+  for (i = 0; i < len; i += PGSIZE)
+    sum += ACTUAL[i];
+  if (getrusage (&usage) != 0)
+    fail ("getrusage failed");
+  if (usage.major_faults != before.major_faults)
+    fail ("%llu major faults for %zu prefetched pages",
+          usage.major_faults - before.major_faults, page_cnt);
+  msg ("prefetched read took no major fault");
+
+  check_mapping (handle, len);
+  munmap (ACTUAL);
+  close (handle);
+  (void) sum;
+}
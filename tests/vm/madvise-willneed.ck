@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(madvise-willneed) begin
+(madvise-willneed) open "large.txt"
+(madvise-willneed) mmap "large.txt"
+(madvise-willneed) getrusage
+(madvise-willneed) madvise MADV_WILLNEED
+(madvise-willneed) prefetched read took no major fault
+(madvise-willneed) end
+madvise-willneed: exit(0)
+EOF
+pass;
@@ -0,0 +1,26 @@
+/* Shared code for the madvise tests. */
+
+#include "tests/vm/madvise.h"
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+/* Verifies that the first LEN bytes mapped at ACTUAL match the file
+   open as HANDLE, reading the file with read(). */
+void
+check_mapping (int handle, size_t len)
+{
+  static char buf[PGSIZE];
+  size_t ofs;
+
+  seek (handle, 0);
+  for (ofs = 0; ofs < len; ofs += PGSIZE)
+    {
+      size_t size = len - ofs < PGSIZE ? len - ofs : PGSIZE;
+
+      if (read (handle, buf, size) != (int) size)
+        fail ("read of \"large.txt\" at offset %zu failed", ofs);
+      if (memcmp (ACTUAL + ofs, buf, size))
+        fail ("mapping of \"large.txt\" differs at offset %zu", ofs);
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef TESTS_VM_MADVISE_H
+#define TESTS_VM_MADVISE_H
+
+#include <stddef.h>
+
+#define PGSIZE 4096
+#define ACTUAL ((char *) 0x10000000)
+
+void check_mapping (int handle, size_t len);
+
+#endif /* tests/vm/madvise.h */
@@ -0,0 +1,37 @@
+/* Limits the process to a few resident pages, touches many more,
+   and checks that it stays within the limit without losing data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PGSIZE 4096
+#define LIMIT 16
+#define PAGE_CNT 64
+
+static char buf[PAGE_CNT * PGSIZE] __attribute__ ((aligned (PGSIZE)));
+
+void
+test_main (void)
+{
+  struct rusage usage;
+  size_t i;
+
+  CHECK (memlimit (LIMIT, RECLAIM_PRIO_MAX + 1) == -1,
+         "memlimit with bad priority must fail");
+  CHECK (memlimit (LIMIT, RECLAIM_PRIO_MIN) == 0, "memlimit");
+
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * PGSIZE] = i;
+  CHECK (getrusage (&usage) == 0, "getrusage");
+  if (usage.anon_pages > LIMIT + 1)
+    fail ("%llu anonymous pages resident, limit is %d",
+          usage.anon_pages, LIMIT);
+  msg ("resident memory within limit");
+
+  for (i = 0; i < PAGE_CNT; i++)
+    if (buf[i * PGSIZE] != (char) i)
+      fail ("page %zu holds %d, not %zu", i, buf[i * PGSIZE], i);
+  msg ("evicted pages read back");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(memlimit) begin
+(memlimit) memlimit with bad priority must fail
+(memlimit) memlimit
+(memlimit) getrusage
+(memlimit) resident memory within limit
+(memlimit) evicted pages read back
+(memlimit) end
+memlimit: exit(0)
+EOF
+pass;
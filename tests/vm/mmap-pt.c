@@ -0,0 +1,45 @@
+/* Maps and touches a file far away from the rest of the address
+   space, which needs new page tables, and checks that unmapping it
+   gives those page tables back. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x80000000)
+
+static unsigned long long
+pt_pages (void)
+{
+  struct rusage usage;
+
+  if (getrusage (&usage) != 0)
+    fail ("getrusage failed");
+  return usage.pt_pages;
+}
+
+void
+test_main (void)
+{
+  unsigned long long before, mapped;
+  int handle;
+  int i;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  before = pt_pages ();
+  for (i = 0; i < 3; i++)
+    {
+      CHECK (mmap (ACTUAL, 4096, 0, handle, 0) != MAP_FAILED,
+             "mmap \"sample.txt\"");
+      (void) *(volatile char *) ACTUAL;
+      mapped = pt_pages ();
+      if (mapped <= before)
+        fail ("mapping used no page table pages");
+      munmap (ACTUAL);
+      if (pt_pages () != before)
+        fail ("%llu page table pages after munmap, %llu before mmap",
+              pt_pages (), before);
+    }
+  msg ("page tables freed after munmap");
+  close (handle);
+}
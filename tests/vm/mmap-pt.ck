@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmap-pt) begin
+(mmap-pt) open "sample.txt"
+(mmap-pt) mmap "sample.txt"
+(mmap-pt) mmap "sample.txt"
+(mmap-pt) mmap "sample.txt"
+(mmap-pt) page tables freed after munmap
+(mmap-pt) end
+mmap-pt: exit(0)
+EOF
+pass;
@@ -0,0 +1,53 @@
+/* Maps sample.txt twice, writes through one mapping and reads the
+   data through the other.  Then forks a child that writes through
+   its inherited mapping, and checks that the parent sees the write
+   before and after the file is unmapped. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define ALIAS ((char *) 0x20000000)
+
+void
+test_main (void)
+{
+  size_t len = strlen (sample);
+  int handle, handle2;
+  pid_t child;
+
+  CHECK (create ("sample.txt", len), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((handle2 = open ("sample.txt")) > 1, "open \"sample.txt\" again");
+  CHECK (mmap (ACTUAL, len, 1, handle, 0) != MAP_FAILED,
+         "mmap \"sample.txt\"");
+  CHECK (mmap (ALIAS, len, 0, handle2, 0) != MAP_FAILED,
+         "mmap \"sample.txt\" again");
+
+  /* Both mappings share a frame. */
+  ACTUAL[0] = 'x';
+  if (ALIAS[0] != 'x')
+    fail ("write not visible through the second mapping");
+  msg ("write visible through the second mapping");
+  ACTUAL[0] = '\0';
+
+  child = fork ("child");
+  if (child == 0)
+    {
+      memcpy (ACTUAL, sample, len);
+      exit (0);
+    }
+  CHECK (wait (child) == 0, "wait for child");
+  if (memcmp (ALIAS, sample, len))
+    fail ("child's write not visible in parent");
+  msg ("child's write visible in parent");
+
+  munmap (ACTUAL);
+  munmap (ALIAS);
+  close (handle);
+  close (handle2);
+  check_file ("sample.txt", sample, len);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-shared) begin
+(mmap-shared) create "sample.txt"
+(mmap-shared) open "sample.txt"
+(mmap-shared) open "sample.txt" again
+(mmap-shared) mmap "sample.txt"
+(mmap-shared) mmap "sample.txt" again
+(mmap-shared) write visible through the second mapping
+(mmap-shared) wait for child
+(mmap-shared) child's write visible in parent
+(mmap-shared) open "sample.txt" for verification
+(mmap-shared) verified contents of "sample.txt"
+(mmap-shared) close "sample.txt"
+(mmap-shared) end
+EOF
+pass;
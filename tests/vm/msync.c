@@ -0,0 +1,53 @@
+/* Writes to a file through a mapping and flushes it with msync(),
+   checking that the data reached the disk and, with read(), the file
+   while it is still mapped, and that flushing clean pages writes
+   nothing. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+static char buf[sizeof sample];
+
+void
+test_main (void)
+{
+  size_t len = strlen (sample);
+  long long writes;
+  int handle;
+
+  CHECK (create ("sample.txt", len), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (mmap (ACTUAL, len, 1, handle, 0) != MAP_FAILED, "mmap \"sample.txt\"");
+  memcpy (ACTUAL, sample, len);
+  writes = get_fs_disk_write_cnt ();
+  CHECK (msync (ACTUAL, len, MS_SYNC) == 0, "msync MS_SYNC");
+  if (get_fs_disk_write_cnt () == writes)
+    fail ("msync left a modified page off the disk");
+  CHECK (read (handle, buf, len) == (int) len, "read \"sample.txt\"");
+  if (memcmp (buf, sample, len))
+    fail ("file does not hold the data written through the mapping");
+  msg ("file holds the data written through the mapping");
+
+  writes = get_fs_disk_write_cnt ();
+  CHECK (msync (ACTUAL, len, MS_SYNC) == 0, "msync MS_SYNC on clean mapping");
+  if (get_fs_disk_write_cnt () != writes)
+    fail ("msync wrote back a clean page");
+
+  ACTUAL[0] = 'X';
+  CHECK (msync (ACTUAL, len, MS_ASYNC) == 0, "msync MS_ASYNC");
+  CHECK (msync (ACTUAL, len, 0) == -1, "msync with bad flags must fail");
+  CHECK (msync (ACTUAL + 0x100000, 4096, MS_SYNC) == -1,
+         "msync of unmapped memory must fail");
+  munmap (ACTUAL);
+  close (handle);
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\" again");
+  CHECK (read (handle, buf, 1) == 1 && buf[0] == 'X',
+         "read back byte written before MS_ASYNC");
+  close (handle);
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(msync) begin
+(msync) create "sample.txt"
+(msync) open "sample.txt"
+(msync) mmap "sample.txt"
+(msync) msync MS_SYNC
+(msync) read "sample.txt"
+(msync) file holds the data written through the mapping
+(msync) msync MS_SYNC on clean mapping
+(msync) msync MS_ASYNC
+(msync) msync with bad flags must fail
+(msync) msync of unmapped memory must fail
+(msync) open "sample.txt" again
+(msync) read back byte written before MS_ASYNC
+(msync) end
+msync: exit(0)
+EOF
+pass;
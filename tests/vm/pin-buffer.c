@@ -0,0 +1,47 @@
+/* Writes a file from, and reads it back into, buffers that span more
+   pages than the process may keep resident, so the kernel must bring
+   in and hold the whole buffer for each call.  Then reads into a range
+   whose second page is mapped read-only, which must kill the process
+   before anything is read. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PGSIZE 4096
+#define PAGE_CNT 16
+#define ACTUAL ((char *) 0x10000000)
+
+static char src[PAGE_CNT * PGSIZE] __attribute__ ((aligned (PGSIZE)));
+static char dst[PAGE_CNT * PGSIZE] __attribute__ ((aligned (PGSIZE)));
+
+void
+test_main (void)
+{
+  size_t i;
+  int handle;
+
+  for (i = 0; i < sizeof src; i++)
+    src[i] = i * 7 + i / PGSIZE;
+  CHECK (create ("big", sizeof src), "create \"big\"");
+  CHECK ((handle = open ("big")) > 1, "open \"big\"");
+  CHECK (memlimit (PAGE_CNT / 2, RECLAIM_PRIO_DEFAULT) == 0, "memlimit");
+
+  CHECK (write (handle, src, sizeof src) == (int) sizeof src,
+         "write \"big\"");
+  seek (handle, 0);
+  CHECK (read (handle, dst, sizeof dst) == (int) sizeof dst, "read \"big\"");
+  if (memcmp (src, dst, sizeof src))
+    fail ("data read back differs from data written");
+  msg ("data read back matches");
+
+  CHECK (mmap (ACTUAL, PGSIZE, 1, handle, 0) != MAP_FAILED,
+         "mmap \"big\" read/write");
+  CHECK (mmap (ACTUAL + PGSIZE, PGSIZE, 0, handle, PGSIZE) != MAP_FAILED,
+         "mmap \"big\" read-only");
+  seek (handle, 0);
+  msg ("read into partly read-only buffer");
+  read (handle, ACTUAL, 2 * PGSIZE);
+  fail ("read into read-only page succeeded");
+}
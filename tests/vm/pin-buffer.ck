@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(pin-buffer) begin
+(pin-buffer) create "big"
+(pin-buffer) open "big"
+(pin-buffer) memlimit
+(pin-buffer) write "big"
+(pin-buffer) read "big"
+(pin-buffer) data read back matches
+(pin-buffer) mmap "big" read/write
+(pin-buffer) mmap "big" read-only
+(pin-buffer) read into partly read-only buffer
+pin-buffer: exit(-1)
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Checks that getrusage() accounts for resident anonymous and file
+   pages, page faults, and bytes moved by read() and write(). */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PGSIZE 4096
+#define ANON_PAGES 8
+#define ACTUAL ((char *) 0x10000000)
+
+static char anon[ANON_PAGES * PGSIZE] __attribute__ ((aligned (PGSIZE)));
+
+void
+test_main (void)
+{
+  struct rusage before, after;
+  char buf[128];
+  size_t i, len;
+  int handle;
+
+  CHECK (getrusage (&before) == 0, "getrusage");
+  for (i = 0; i < sizeof anon; i += PGSIZE)
+    anon[i] = 1;
+  CHECK (getrusage (&after) == 0, "getrusage after touching memory");
+  if (after.anon_pages < before.anon_pages + ANON_PAGES)
+    fail ("%llu resident anonymous pages, expected at least %llu",
+          after.anon_pages, before.anon_pages + ANON_PAGES);
+  if (after.minor_faults + after.major_faults
+      < before.minor_faults + before.major_faults + ANON_PAGES)
+    fail ("touching %d pages did not count as page faults", ANON_PAGES);
+  msg ("anonymous pages accounted");
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  len = filesize (handle);
+  CHECK (mmap (ACTUAL, len, 0, handle, 0) != MAP_FAILED, "mmap \"sample.txt\"");
+  before = after;
+  (void) *(volatile char *) ACTUAL;
+  CHECK (getrusage (&after) == 0, "getrusage after touching mapping");
+  if (after.file_pages < before.file_pages + 1)
+    fail ("%llu resident file pages, expected at least %llu",
+          after.file_pages, before.file_pages + 1);
+  msg ("file page accounted");
+
+  before = after;
+  CHECK (read (handle, buf, sizeof buf) == sizeof buf, "read \"sample.txt\"");
+  CHECK (getrusage (&after) == 0, "getrusage after read");
+  if (after.read_bytes != before.read_bytes + sizeof buf)
+    fail ("read %zu bytes, but %llu accounted",
+          sizeof buf, after.read_bytes - before.read_bytes);
+  msg ("read bytes accounted");
+
+  munmap (ACTUAL);
+  close (handle);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rusage) begin
+(rusage) getrusage
+(rusage) getrusage after touching memory
+(rusage) anonymous pages accounted
+(rusage) open "sample.txt"
+(rusage) mmap "sample.txt"
+(rusage) getrusage after touching mapping
+(rusage) file page accounted
+(rusage) read "sample.txt"
+(rusage) getrusage after read
+(rusage) read bytes accounted
+(rusage) end
+rusage: exit(0)
+EOF
+pass;
@@ -31,6 +31,7 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/ksm.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -216,6 +217,15 @@ parse_options (char **argv) {
 #ifdef FILESYS
 		else if (!strcmp (name, "-f"))
 			format_filesys = true;
+#endif
+#ifdef EFILESYS
+		else if (!strcmp (name, "-o")) {
+			fat_format_cluster_sectors = atoi (value);
+			if (fat_format_cluster_sectors < 1
+					|| fat_format_cluster_sectors > MAX_SECTORS_PER_CLUSTER)
+				PANIC ("-o: sectors per cluster must be 1 to %d",
+						MAX_SECTORS_PER_CLUSTER);
+		}
 #endif
 		else if (!strcmp (name, "-rs"))
 			random_init (atoi (value));
@@ -226,6 +236,18 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+		else if (!strcmp (name, "-rusage"))
+			process_print_rusage = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-ksm-scan"))
+			ksm_pages_to_scan = atoi (value);
+		else if (!strcmp (name, "-ksm-sleep"))
+			ksm_sleep_millisecs = atoi (value);
+		else if (!strcmp (name, "-low-wmark"))
+			vm_low_wmark = atoi (value);
+		else if (!strcmp (name, "-high-wmark"))
+			vm_high_wmark = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -324,10 +346,22 @@ usage (void) {
 			"  -h                 Print this help message and power off.\n"
 			"  -q                 Power off VM after actions or on panic.\n"
 			"  -f                 Format file system disk during startup.\n"
+#ifdef EFILESYS
+			"  -o=SECTORS         Format with SECTORS sectors per cluster\n"
+			"                     (1-64, default: by disk size).\n"
+#endif
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+			"  -rusage            Print resource usage when processes exit.\n"
+#endif
+#ifdef VM
+			"  -ksm-scan=PAGES    Merge up to PAGES pages per pass (0=off).\n"
+			"  -ksm-sleep=MS      Sleep MS milliseconds between merge passes.\n"
+			"  -low-wmark=PAGES   Start background reclaim below PAGES free\n"
+			"                     user pages (0=off).\n"
+			"  -high-wmark=PAGES  Stop background reclaim at PAGES free.\n"
 #endif
 			);
 	power_off ();
@@ -362,4 +396,7 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
@@ -262,6 +262,100 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	}
 }
 
+/* Returns true if TABLE, a page of any level of a page map, has no
+ * present entries. */
+static bool
+table_is_empty (const uint64_t *table) {
+	for (unsigned i = 0; i < PGSIZE / sizeof (uint64_t); i++)
+		if (table[i] & PTE_P)
+			return false;
+	return true;
+}
+
+/* Frees the table that entry E points to and clears E, if the table
+ * has no present entries.  Returns true if it did. */
+static bool
+free_if_empty (uint64_t *e) {
+	uint64_t *table;
+
+	if (!(*e & PTE_P))
+		return false;
+	table = ptov (PTE_ADDR (*e));
+	if (!table_is_empty (table))
+		return false;
+	*e = 0;
+	palloc_free_page (table);
+	return true;
+}
+
+/* Frees the page tables of PML4 that cover user virtual addresses in
+ * [START, END) and no longer map a present page, along with the page
+ * directories and page directory pointer tables that become empty.
+ * Returns the number of pages freed.
+ * The caller must keep other threads from mapping pages in the
+ * range while this runs. */
+size_t
+pml4_free_tables (uint64_t *pml4, void *start, void *end) {
+	uint64_t va = (uint64_t) start & ~((1UL << PDXSHIFT) - 1);
+	size_t freed = 0;
+
+	ASSERT (pml4 != base_pml4);
+
+	for (; va < (uint64_t) end && is_user_vaddr (va); va += 1UL << PDXSHIFT) {
+		uint64_t *pml4e = &pml4[PML4 (va)];
+		uint64_t *pdpe, *pde;
+
+		if (!(*pml4e & PTE_P))
+			continue;
+		pdpe = (uint64_t *) ptov (PTE_ADDR (*pml4e)) + PDPE (va);
+		if (!(*pdpe & PTE_P))
+			continue;
+		pde = (uint64_t *) ptov (PTE_ADDR (*pdpe)) + PDX (va);
+		if (!free_if_empty (pde))
+			continue;
+		freed++;
+		if (free_if_empty (pdpe)) {
+			freed++;
+			if (free_if_empty (pml4e))
+				freed++;
+		}
+	}
+
+	/* invlpg drops every cached paging-structure entry, not only
+	 * those for the address given. */
+	if (freed > 0 && rcr3 () == vtop (pml4))
+		invlpg ((uint64_t) start);
+	return freed;
+}
+
+/* Returns the number of pages PML4 uses to map user virtual
+ * addresses, counting PML4 itself. */
+size_t
+pml4_table_cnt (uint64_t *pml4) {
+	size_t cnt = 1;
+
+	for (unsigned i = 0; i < PML4 (KERN_BASE); i++) {
+		uint64_t *pdp;
+
+		if (!(pml4[i] & PTE_P))
+			continue;
+		cnt++;
+		pdp = ptov (PTE_ADDR (pml4[i]));
+		for (unsigned j = 0; j < PGSIZE / sizeof (uint64_t); j++) {
+			uint64_t *pd;
+
+			if (!(pdp[j] & PTE_P))
+				continue;
+			cnt++;
+			pd = ptov (PTE_ADDR (pdp[j]));
+			for (unsigned k = 0; k < PGSIZE / sizeof (uint64_t); k++)
+				if (pd[k] & PTE_P)
+					cnt++;
+		}
+	}
+	return cnt;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
  * installed.
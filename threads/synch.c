@@ -398,4 +398,66 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 
 	while (!list_empty (&cond->waiters))
 		cond_signal (cond, lock);
-}
\ No newline at end of file
+}
+
+/* Initializes RW, a readers-writer lock.  Any number of readers
+   can hold it at once, or a single writer.  A waiting writer
+   keeps new readers out, so that it is not starved. */
+void
+rwlock_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_init (&rw->lock);
+	cond_init (&rw->readers_ok);
+	cond_init (&rw->writer_ok);
+	rw->reader_cnt = 0;
+	rw->writer_waiting_cnt = 0;
+	rw->writer = false;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it or
+   waits for it. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+	lock_acquire (&rw->lock);
+	while (rw->writer || rw->writer_waiting_cnt > 0)
+		cond_wait (&rw->readers_ok, &rw->lock);
+	rw->reader_cnt++;
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, held for reading. */
+void
+rwlock_release_read (struct rwlock *rw) {
+	lock_acquire (&rw->lock);
+	ASSERT (rw->reader_cnt > 0);
+	if (--rw->reader_cnt == 0)
+		cond_signal (&rw->writer_ok, &rw->lock);
+	lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until nobody else holds
+   it. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+	lock_acquire (&rw->lock);
+	rw->writer_waiting_cnt++;
+	while (rw->writer || rw->reader_cnt > 0)
+		cond_wait (&rw->writer_ok, &rw->lock);
+	rw->writer_waiting_cnt--;
+	rw->writer = true;
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, held for writing. */
+void
+rwlock_release_write (struct rwlock *rw) {
+	lock_acquire (&rw->lock);
+	ASSERT (rw->writer);
+	rw->writer = false;
+	if (rw->writer_waiting_cnt > 0)
+		cond_signal (&rw->writer_ok, &rw->lock);
+	else
+		cond_broadcast (&rw->readers_ok, &rw->lock);
+	lock_release (&rw->lock);
+}
@@ -515,7 +515,12 @@ init_thread (struct thread *t, const char *name, int priority) {
     sema_init(&t->wait_sema,0);
     sema_init(&t->fork_sema,0);
     sema_init(&t->free_sema,0);
+    sema_init(&t->reap_sema,0);
 	t->running = NULL;
+#ifdef VM
+	list_init(&t->mmap_list);
+	t->reclaim_prio = RECLAIM_PRIO_DEFAULT;
+#endif
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
@@ -13,6 +13,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -22,9 +23,22 @@
 #include "userprog/process.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/share.h"
 #endif
 
+/* 종료할 때 자원 사용량을 출력할지 여부 (-rusage) */
+bool process_print_rusage;
+
+/* reaper에게 넘겨진, 종료된 프로세스들 */
+static struct list reap_list;
+static struct lock reap_lock;
+static struct semaphore reap_cnt;	// reap_list의 원소 수
+
 static void process_cleanup(void);
+static void reaper_start(void);
+static void reaper(void *aux UNUSED);
+static void reap(struct thread *t);
+static void free_fdt(struct thread *t);
 static bool load(const char *file_name, struct intr_frame *if_);
 static void initd(void *f_name);
 static void __do_fork(void *);
@@ -73,6 +87,7 @@ tid_t process_create_initd(const char *file_name)
 	if (fn_copy == NULL)
 		return TID_ERROR;
 	strlcpy(fn_copy, file_name, PGSIZE); //해당 페이지에 file_name을 copy로 저장함
+	reaper_start();
 
 	// project 2 : system call
 	// file_name을 분리해서 넣어줘야함
@@ -211,6 +226,17 @@ __do_fork(void *aux)
 	process_activate(current);
 #ifdef VM
 	supplemental_page_table_init(&current->spt);
+	/* Lazily loaded segment pages read from the child's own handle of
+	 * the executable. */
+	if (parent->running != NULL)
+	{
+		current->running = file_duplicate(parent->running);
+		if (current->running == NULL)
+			goto error;
+	}
+	/* 메모리 한도와 회수 우선순위는 자식에게 상속 */
+	current->rss_limit = parent->rss_limit;
+	current->reclaim_prio = parent->reclaim_prio;
 	if (!supplemental_page_table_copy(&current->spt, &parent->spt))
 		goto error;
 #else
@@ -424,19 +450,131 @@ void process_exit(void)
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
 
-	for (int i = 0; i < FDT_COUNT_LIMIT; i++) // 바이트단위로 들어가서 하나하나 다 지워준다.
+	/* 주소 공간을 정리하기 전에 자원 사용량 출력 */
+	if (process_print_rusage && cur->pml4 != NULL)
 	{
-		close(i);
+		struct rusage usage;
+
+		process_get_rusage(&usage);
+		printf("%s: rusage: anon %llu file %llu swap %llu pt %llu minflt %llu "
+			   "majflt %llu cow %llu read %llu write %llu\n",
+			   cur->name, usage.anon_pages, usage.file_pages,
+			   usage.swap_pages, usage.pt_pages, usage.minor_faults,
+			   usage.major_faults, usage.cow_breaks, usage.read_bytes,
+			   usage.write_bytes);
 	}
-	// for multi-oom(메모리 누수)
-	palloc_free_multiple(cur->fd_table, FDT_PAGES);
+
+	if (cur->pml4 == NULL)
+	{
+		/* 주소 공간이 없으면 FDT만 직접 정리 */
+		free_fdt(cur);
+		file_close(cur->running);
+		cur->running = NULL;
+		sema_up(&cur->wait_sema);
+		sema_down(&cur->free_sema);
+		return;
+	}
+#ifdef VM
+	/* 부모가 wait에서 돌아오자마자 볼 수 있는 것들은 종료 상태를 알리기 전에
+	 * 정리: 실행 파일 쓰기 금지 해제, mmap 영역의 write-back */
+	supplemental_page_table_unshare(&cur->spt);
+#endif
 	// for rox- (실행중에 수정 못하도록)
+	// vmworkd가 실행 파일로 페이지를 읽을 수 있으므로 unshare가 기다린 뒤에 닫는다
 	file_close(cur->running);
-	
+	cur->running = NULL;
 
+	/* 나머지 FDT와 주소 공간은 reaper에게 넘긴다. 페이지들이 이 스레드를
+	 * 가리키므로, 정리가 끝날 때까지 스레드 자체는 남아 있는다. */
 	sema_up(&cur->wait_sema);	// 종료되었다고 기다리고 있는 부모 thread에게 signal 보냄-> sema_up에서 val을 올려줌
+	lock_acquire(&reap_lock);
+	list_push_back(&reap_list, &cur->reap_elem);
+	lock_release(&reap_lock);
+	sema_up(&reap_cnt);
 	sema_down(&cur->free_sema); // 부모의 exit_Status가 정확히 전달되었는지 확인(wait)
-	process_cleanup();			// pml4를 날림(이 함수를 call 한 thread의 pml4)
+	sema_down(&cur->reap_sema);
+}
+
+/* T의 열린 파일을 모두 닫고 FDT를 해제한다. */
+static void free_fdt(struct thread *t)
+{
+	for (int i = 0; i < FDT_COUNT_LIMIT; i++)
+	{
+		struct file *file = t->fd_table[i];
+
+		/* 1, 2는 stdin, stdout 표시 */
+		if ((uintptr_t)file > 2)
+		{
+			file_close(file);
+		}
+	}
+	// for multi-oom(메모리 누수)
+	palloc_free_multiple(t->fd_table, FDT_PAGES);
+	t->fd_table = NULL;
+}
+
+/* reaper 스레드를 한 번만 만든다. 첫 유저 프로세스보다 먼저 불려야 한다.
+ * run 액션마다 process_create_initd()가 불리므로 두 번째부터는 그냥 돌아간다. */
+static void reaper_start(void)
+{
+	static bool started;
+
+	if (started)
+		return;
+	started = true;
+	list_init(&reap_list);
+	lock_init(&reap_lock);
+	sema_init(&reap_cnt, 0);
+	if (thread_create("reaper", PRI_DEFAULT, reaper, NULL) == TID_ERROR)
+		PANIC("cannot start reaper");
+}
+
+/* 종료된 프로세스들의 FDT와 주소 공간을 차례로 정리하는 스레드.
+ * 부모의 wait와 다음 fork가 큰 프로세스의 정리를 기다리지 않게 한다. */
+static void reaper(void *aux UNUSED)
+{
+	for (;;)
+	{
+		struct thread *t;
+
+		sema_down(&reap_cnt);
+		lock_acquire(&reap_lock);
+		t = list_entry(list_pop_front(&reap_list), struct thread, reap_elem);
+		lock_release(&reap_lock);
+
+		reap(t);
+		sema_up(&t->reap_sema);
+	}
+}
+
+/* 종료된 프로세스 T의 열린 파일을 닫고 주소 공간을 해제한다.
+ * T는 reap_sema에서 잠들어 있으므로 T의 pml4는 활성화되어 있지 않다. */
+static void reap(struct thread *t)
+{
+	uint64_t *pml4 = t->pml4;
+
+	free_fdt(t);
+#ifdef VM
+	/* 프레임이 모두 풀리기 전에는 eviction이 T의 pml4를 볼 수 있다. */
+	supplemental_page_table_kill(&t->spt);
+#endif
+	t->pml4 = NULL;
+	pml4_destroy(pml4);
+}
+
+/* 현재 프로세스의 자원 사용량을 USAGE에 채운다.
+ * fault 수와 read/write 바이트는 누적치, 메모리 항목은 현재 값이다. */
+void process_get_rusage(struct rusage *usage)
+{
+	struct thread *cur = thread_current();
+
+	*usage = cur->rusage;
+	usage->pt_pages = cur->pml4 != NULL ? pml4_table_cnt(cur->pml4) : 0;
+#ifdef VM
+	vm_get_rusage(usage);
+#else
+	usage->anon_pages = usage->file_pages = usage->swap_pages = 0;
+#endif
 }
 
 /* Free the current process's resources. */
@@ -446,8 +584,13 @@ process_cleanup(void)
 	struct thread *curr = thread_current();
 
 #ifdef VM
+	supplemental_page_table_unshare(&curr->spt);
 	supplemental_page_table_kill(&curr->spt);
 #endif
+	/* 이전 실행 파일은 페이지들이 모두 사라진 뒤에 닫아 쓰기 금지를 푼다.
+	 * fork된 자식도 부모 실행 파일의 핸들을 갖고 있다. */
+	file_close(curr->running);
+	curr->running = NULL;
 
 	uint64_t *pml4;
 	/* Destroy the current process's page directory and switch back
@@ -813,9 +956,14 @@ install_page(void *upage, void *kpage, bool writable)
 static bool
 lazy_load_segment(struct page *page, void *aux)
 {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	struct lazy_load_arg *arg = aux;
+	void *kva = page->frame->kva;
+	bool success;
+
+	/* arg는 페이지가 소유하며, MADV_DONTNEED 후 다시 읽을 때도 쓰인다 */
+	success = file_read_at(arg->file, kva, arg->read_bytes, arg->ofs) == (off_t)arg->read_bytes;
+	memset((uint8_t *)kva + arg->read_bytes, 0, PGSIZE - arg->read_bytes);
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -848,16 +996,34 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer(VM_ANON, upage,
-											writable, lazy_load_segment, aux))
-			return false;
+		/* Read-only pages with file data are the same in every process
+		 * running this executable, so they share one frame. */
+		if (!writable && page_read_bytes > 0)
+		{
+			if (!share_alloc_page(upage, file, ofs, page_read_bytes, false, NULL))
+				return false;
+		}
+		else
+		{
+			struct lazy_load_arg *aux = malloc(sizeof *aux);
+			if (aux == NULL)
+				return false;
+			aux->file = file;
+			aux->ofs = ofs;
+			aux->read_bytes = page_read_bytes;
+			if (!vm_alloc_page_with_initializer(VM_ANON, upage,
+												writable, lazy_load_segment, aux))
+			{
+				free(aux);
+				return false;
+			}
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
+		ofs += PGSIZE;
 	}
 	return true;
 }
@@ -869,11 +1035,12 @@ setup_stack(struct intr_frame *if_)
 	bool success = false;
 	void *stack_bottom = (void *)(((uint8_t *)USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
+	if (vm_alloc_page(VM_ANON | VM_STACK, stack_bottom, true))
+	{
+		success = vm_claim_page(stack_bottom);
+		if (success)
+			if_->rsp = USER_STACK;
+	}
 	return success;
 }
 #endif /* VM */
@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -15,6 +16,9 @@
 #include "threads/vaddr.h"
 #include "userprog/process.h"
 #include "threads/synch.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
@@ -33,9 +37,20 @@ unsigned tell(int fd);
 void close(int fd);
 tid_t fork (const char *thread_name, struct intr_frame *f);
 int exec (char *file_name);
+int getrusage(struct rusage *usage);
+#ifdef VM
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset);
+void munmap(void *addr);
+int madvise(void *addr, size_t length, int advice);
+int msync(void *addr, size_t length, int flags);
+int memlimit(size_t max_pages, int reclaim_prio);
+#endif
 
 /* syscall helper functions */
 void check_address(void *addr);
+#ifdef VM
+static void check_writable(void *addr);
+#endif
 static struct file *find_file_by_fd(int fd);
 int add_file_to_fdt(struct file *file);
 void remove_file_from_fdt(int fd);
@@ -64,14 +79,16 @@ void syscall_init(void)
      * mode stack. Therefore, we masked the FLAG_FL. */
     write_msr(MSR_SYSCALL_MASK,
               FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
-
-    lock_init(&filesys_lock);
 }
 
 /* rax에 syscall number 가 들어있으니 이를 syscall-nr.h에 선언된 enum으로 비교 & 확인
     들어가는 인자는 단순히 들어오는 순서대로 rdi, rsi, rdx ... */
 void syscall_handler(struct intr_frame *f UNUSED)
 {
+#ifdef VM
+    /* 커널 안에서 난 page fault도 stack growth 여부를 판단할 수 있도록 유저 rsp 저장 */
+    thread_current()->user_rsp = (void *)f->rsp;
+#endif
     switch (f->R.rax)
     {
     case SYS_HALT:
@@ -117,6 +134,26 @@ void syscall_handler(struct intr_frame *f UNUSED)
     case SYS_CLOSE:
         close(f->R.rdi);
         break;
+#ifdef VM
+    case SYS_MMAP:
+        f->R.rax = (uint64_t)mmap((void *)f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10, f->R.r8);
+        break;
+    case SYS_MUNMAP:
+        munmap((void *)f->R.rdi);
+        break;
+    case SYS_MADVISE:
+        f->R.rax = madvise((void *)f->R.rdi, f->R.rsi, f->R.rdx);
+        break;
+    case SYS_MSYNC:
+        f->R.rax = msync((void *)f->R.rdi, f->R.rsi, f->R.rdx);
+        break;
+    case SYS_MEMLIMIT:
+        f->R.rax = memlimit(f->R.rdi, f->R.rsi);
+        break;
+#endif
+    case SYS_GETRUSAGE:
+        f->R.rax = getrusage((struct rusage *)f->R.rdi);
+        break;
     default:
         exit(-1);
         break;
@@ -128,11 +165,29 @@ void check_address(void *addr)
     struct thread *current_thread = thread_current();
     /* 우선 유저영역인지 커널영역인지 확인한 뒤,
          유저영역일지라도 페이지로 할당 된 부분인지 확인 */
-    if (addr = NULL||is_kernel_vaddr(addr) || pml4_get_page(current_thread->pml4, addr) == NULL)
+#ifdef VM
+    /* lazy loading 때문에 아직 매핑되지 않은 페이지도 spt에 있으면 유효 */
+    if (addr == NULL || is_kernel_vaddr(addr) || spt_find_page(&current_thread->spt, addr) == NULL)
+#else
+    if (addr == NULL || is_kernel_vaddr(addr) || pml4_get_page(current_thread->pml4, addr) == NULL)
+#endif
+    {
+        exit(-1);
+    }
+}
+
+#ifdef VM
+/* read로 채울 버퍼가 쓰기 가능한 페이지인지 확인 */
+static void check_writable(void *addr)
+{
+    struct page *page = spt_find_page(&thread_current()->spt, addr);
+
+    if (page == NULL || !page->writable)
     {
         exit(-1);
     }
 }
+#endif
 
 /* fd를 통해 file을 찾는 함수 */
 static struct file *find_file_by_fd(int fd)
@@ -218,12 +273,10 @@ bool remove(const char *file)
 int open(const char *file)
 {
     check_address(file);
-    lock_acquire(&filesys_lock); //수정
     struct file *open_file = filesys_open(file);
 
     if (open_file == NULL)
     {
-        lock_release(&filesys_lock);
         return -1;
     }
 
@@ -233,7 +286,6 @@ int open(const char *file)
     {
         file_close(open_file);
     }
-    lock_release(&filesys_lock);
     return fd;
 }
 
@@ -265,9 +317,16 @@ int exec(char *file_name)
 int write(int fd, const void *buffer, unsigned size)
 {
     check_address(buffer);
+#ifdef VM
+    /* 버퍼 전체를 미리 올려 고정해 두어, inode 락을 잡은 채로
+       페이지 폴트가 나거나 복사 도중 프레임이 쫓겨나지 않게 함 */
+    if (!vm_pin_pages(buffer, size, false))
+        exit(-1);
+#endif
 
+    /* 파일 시스템은 inode, 디렉터리, free map 마다 따로 락을 잡고,
+       콘솔 출력은 putbuf가 콘솔 락으로 직렬화하므로 전역 락이 필요 없음 */
     int write_result;            // return 용 wirte 한 size
-    lock_acquire(&filesys_lock); //
     struct thread *curr = thread_current();//수정 rox-child
     if (fd == 0)                 // 수정
     {
@@ -298,8 +357,12 @@ int write(int fd, const void *buffer, unsigned size)
             write_result = -1;
         }
     }
-    lock_release(&filesys_lock);
+#ifdef VM
+    vm_unpin_pages(buffer, size);
+#endif
 
+    if (write_result > 0)
+        curr->rusage.write_bytes += write_result;
     return write_result;
 }
 
@@ -307,6 +370,11 @@ int write(int fd, const void *buffer, unsigned size)
 int read(int fd, void *buffer, unsigned size)
 {
     check_address(buffer);
+#ifdef VM
+    /* 채울 버퍼 전체가 쓰기 가능한지 확인하고 미리 올려 고정 */
+    if (!vm_pin_pages(buffer, size, true))
+        exit(-1);
+#endif
     off_t read_byte;
     uint8_t *read_buffer = buffer;
     struct thread *cur = thread_current();
@@ -327,19 +395,25 @@ int read(int fd, void *buffer, unsigned size)
     }
     else if (fd == 1)
     {
-        return -1;
+        read_byte = -1;
     }
     else
     {
         struct file *read_file = find_file_by_fd(fd); //
         if (read_file == NULL)
         {
-            return -1;
+            read_byte = -1;
+        }
+        else
+        {
+            read_byte = file_read(read_file, buffer, size);
         }
-        lock_acquire(&filesys_lock);
-        read_byte = file_read(read_file, buffer, size);
-        lock_release(&filesys_lock);
     }
+#ifdef VM
+    vm_unpin_pages(buffer, size);
+#endif
+    if (read_byte > 0)
+        cur->rusage.read_bytes += read_byte;
     return read_byte;
 }
 
@@ -397,6 +471,88 @@ tid_t fork(const char *thread_name, struct intr_frame *f)
     return process_fork(thread_name, f);
 }
 
+/* 현재 프로세스의 자원 사용량을 usage에 복사 */
+int getrusage(struct rusage *usage)
+{
+    struct rusage tmp;
+
+    check_address(usage);
+    check_address((uint8_t *)usage + sizeof *usage - 1);
+#ifdef VM
+    check_writable(usage);
+    check_writable((uint8_t *)usage + sizeof *usage - 1);
+#endif
+    process_get_rusage(&tmp);
+    memcpy(usage, &tmp, sizeof tmp);
+    return 0;
+}
+
+#ifdef VM
+/* fd로 열린 파일의 offset부터 length 바이트를 addr에 매핑 */
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset)
+{
+    struct file *file = find_file_by_fd(fd);
+
+    if (addr == NULL || pg_ofs(addr) != 0 || offset % PGSIZE != 0 || length == 0)
+        return NULL;
+    if (!is_user_vaddr(addr) || !is_user_vaddr((uint8_t *)addr + length - 1)
+        || (uint8_t *)addr + length < (uint8_t *)addr)
+        return NULL;
+    if (fd < 2 || file == NULL || file_length(file) == 0)
+        return NULL;
+
+    /* 이미 spt에 있는 페이지와 겹치면 실패 */
+    for (size_t ofs = 0; ofs < length; ofs += PGSIZE)
+    {
+        if (spt_find_page(&thread_current()->spt, (uint8_t *)addr + ofs) != NULL)
+            return NULL;
+    }
+    return do_mmap(addr, length, writable, file, offset);
+}
+
+/* addr에서 시작하는 매핑 해제 */
+void munmap(void *addr)
+{
+    do_munmap(addr);
+}
+
+/* addr부터 length 바이트의 메모리 사용 방식을 커널에 알려줌 */
+int madvise(void *addr, size_t length, int advice)
+{
+    if (pg_ofs(addr) != 0 || !is_user_vaddr(addr))
+        return -1;
+    if (length == 0)
+        return 0;
+    if (!is_user_vaddr((uint8_t *)addr + length - 1) || (uint8_t *)addr + length < (uint8_t *)addr)
+        return -1;
+    return vm_madvise(addr, length, advice);
+}
+
+/* addr부터 length 바이트의 mmap 영역 중 수정된 페이지를 파일에 기록 */
+int msync(void *addr, size_t length, int flags)
+{
+    if (pg_ofs(addr) != 0 || !is_user_vaddr(addr))
+        return -1;
+    if (length == 0)
+        return 0;
+    if (!is_user_vaddr((uint8_t *)addr + length - 1) || (uint8_t *)addr + length < (uint8_t *)addr)
+        return -1;
+    return do_msync(addr, length, flags);
+}
+
+/* 상주 페이지 한도(0이면 무제한)와 회수 우선순위 설정, fork 시 자식에게 상속 */
+int memlimit(size_t max_pages, int reclaim_prio)
+{
+    struct thread *cur = thread_current();
+
+    if (reclaim_prio < RECLAIM_PRIO_MIN || reclaim_prio > RECLAIM_PRIO_MAX)
+        return -1;
+    cur->rss_limit = max_pages;
+    cur->reclaim_prio = reclaim_prio;
+    return 0;
+}
+#endif
+
 
 /* 파일 크기 알려주기 */
 /* 이 시스템콜이 어디서 사용되는지 csapp에서 찾아보기
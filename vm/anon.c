@@ -1,7 +1,13 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
+#include <bitmap.h>
+#include <string.h>
 #include "vm/vm.h"
+#include "vm/ksm.h"
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,11 +23,27 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Number of sectors in a swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+/* Swap slot value of a page that is not on the swap disk. */
+#define NO_SLOT BITMAP_ERROR
+
+/* One bit per swap slot, set if the slot is in use. */
+static struct bitmap *swap_table;
+static struct lock swap_lock;
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	size_t slot_cnt = 0;
+
+	swap_disk = disk_get (1, 1);
+	if (swap_disk != NULL)
+		slot_cnt = disk_size (swap_disk) / SECTORS_PER_SLOT;
+	swap_table = bitmap_create (slot_cnt);
+	if (swap_table == NULL)
+		PANIC ("swap table creation failed");
+	lock_init (&swap_lock);
 }
 
 /* Initialize the file mapping */
@@ -31,22 +53,74 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->swap_slot = NO_SLOT;
+	anon_page->type = type;
+	anon_page->init = NULL;
+	anon_page->aux = NULL;
+	anon_page->ksm = NULL;
+	anon_page->unstable = false;
+	memset (kva, 0, PGSIZE);
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot = anon_page->swap_slot;
+
+	if (slot == NO_SLOT)
+		return false;
+
+	for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_read (swap_disk, slot * SECTORS_PER_SLOT + i,
+				(uint8_t *) kva + i * DISK_SECTOR_SIZE);
+
+	lock_acquire (&swap_lock);
+	bitmap_reset (swap_table, slot);
+	lock_release (&swap_lock);
+	anon_page->swap_slot = NO_SLOT;
+	thread_current ()->page_ins++;
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_table, 0, 1, false);
+	lock_release (&swap_lock);
+	if (slot == BITMAP_ERROR)
+		return false;
+
+	for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_write (swap_disk, slot * SECTORS_PER_SLOT + i,
+				(uint8_t *) page->frame->kva + i * DISK_SECTOR_SIZE);
+	anon_page->swap_slot = slot;
+	return true;
+}
+
+/* Returns true if PAGE's contents are in a swap slot. */
+bool
+anon_is_swapped (struct page *page) {
+	return page->anon.swap_slot != NO_SLOT;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	struct frame *frame = ksm_detach_page (page);
+
+	if (frame != NULL)
+		vm_free_frame (frame);
+	if (anon_page->swap_slot != NO_SLOT) {
+		lock_acquire (&swap_lock);
+		bitmap_reset (swap_table, anon_page->swap_slot);
+		lock_release (&swap_lock);
+	}
+	free (anon_page->aux);
 }
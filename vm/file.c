@@ -1,6 +1,14 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <round.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "filesys/inode.h"
 #include "vm/vm.h"
+#include "vm/share.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -21,38 +29,265 @@ vm_file_init (void) {
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	memset (file_page, 0, sizeof *file_page);
+	return true;
+}
+
+/* Reads the contents of PAGE from its file into KVA. */
+static bool
+file_page_read (struct file_page *file_page, void *kva) {
+	if (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->ofs) != (off_t) file_page->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return true;
+}
+
+/* Writes PAGE back to its file if it was modified. */
+static void
+file_page_writeback (struct page *page, void *kva) {
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (pml4 != NULL && pml4_is_dirty (pml4, page->va)) {
+		file_write_at (file_page->file, kva, file_page->read_bytes,
+				file_page->ofs);
+		pml4_set_dirty (pml4, page->va, false);
+	}
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+	return file_page_read (file_page, kva);
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	file_page_writeback (page, page->frame->kva);
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct frame *frame = vm_detach_frame (page);
+
+	if (frame != NULL) {
+		file_page_writeback (page, frame->kva);
+		vm_free_frame (frame);
+	}
 }
 
-/* Do the mmap */
+/* Do the mmap.
+ * The pages go through the shared frame index, so processes mapping
+ * the same part of a file share its frames.  Each page holds as much of
+ * the file as fits, whatever LENGTH is, so that all of its mappers
+ * agree on what it contains. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct thread *t = thread_current ();
+	struct mmap_region *region;
+	off_t size;
+	size_t i;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	region->file = file_reopen (file);
+	if (region->file == NULL) {
+		free (region);
+		return NULL;
+	}
+	region->addr = addr;
+	region->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	region->advice = MADV_NORMAL;
+
+	/* Allocate the sectors that stores through the mapping may dirty,
+	 * so that writing them back allocates none, which it could not do
+	 * as an operation of the journal. */
+	size = file_length (region->file);
+	if (writable && offset < size
+			&& !inode_fill (file_get_inode (region->file),
+				size - offset < (off_t) (region->page_cnt * PGSIZE)
+				? size - offset : (off_t) (region->page_cnt * PGSIZE),
+				offset)) {
+		file_close (region->file);
+		free (region);
+		return NULL;
+	}
+
+	lock_acquire (&t->spt.lock);
+	for (i = 0; i < region->page_cnt; i++) {
+		off_t ofs = offset + i * PGSIZE;
+		size_t read_bytes = 0;
+
+		if (ofs < size)
+			read_bytes = size - ofs < PGSIZE ? size - ofs : PGSIZE;
+		if (!share_alloc_page ((uint8_t *) addr + i * PGSIZE, region->file,
+					ofs, read_bytes, writable, region))
+			goto fail;
+	}
+
+	list_push_back (&t->mmap_list, &region->elem);
+	lock_release (&t->spt.lock);
+	return addr;
+
+fail:
+	while (i-- > 0) {
+		struct page *page = spt_find_page (&t->spt,
+				(uint8_t *) addr + i * PGSIZE);
+		spt_remove_page (&t->spt, page);
+	}
+	lock_release (&t->spt.lock);
+	file_close (region->file);
+	free (region);
+	return NULL;
+}
+
+/* Returns the current process's mmap() region starting at ADDR, or a
+ * null pointer if there is none. */
+static struct mmap_region *
+find_region (void *addr) {
+	struct list *mmap_list = &thread_current ()->mmap_list;
+
+	for (struct list_elem *e = list_begin (mmap_list);
+			e != list_end (mmap_list); e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		if (region->addr == addr)
+			return region;
+	}
+	return NULL;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct thread *t = thread_current ();
+	struct mmap_region *region = find_region (addr);
+
+	if (region == NULL)
+		return;
+
+	lock_acquire (&t->spt.lock);
+	for (size_t i = 0; i < region->page_cnt; i++) {
+		struct page *page = spt_find_page (&t->spt,
+				(uint8_t *) addr + i * PGSIZE);
+		if (page != NULL)
+			spt_remove_page (&t->spt, page);
+	}
+	if (t->pml4 != NULL)
+		pml4_free_tables (t->pml4, addr,
+				(uint8_t *) addr + region->page_cnt * PGSIZE);
+	lock_release (&t->spt.lock);
+	list_remove (&region->elem);
+	file_close (region->file);
+	free (region);
+}
+
+/* Writes back PAGE if it belongs to an mmap() region and was modified.
+ * Must be called with the SPT lock held. */
+static void
+sync_page (struct page *page) {
+	if (page != NULL && (page->operations->type & VM_SHARED)
+			&& page->file.region != NULL)
+		share_sync_page (page);
+}
+
+/* Do the msync.
+ * Writes the modified pages among the LENGTH bytes at page-aligned
+ * ADDR back to their files, in file order.  With MS_SYNC, returns once
+ * they are on the disk, flushing each region's part of the range from
+ * the buffer cache at once; with MS_ASYNC, leaves them to vmworkd.
+ * Returns 0 if successful, -1 if FLAGS is invalid or part of the range
+ * is not mapped by mmap(). */
+int
+do_msync (void *addr, size_t length, int flags) {
+	struct thread *t = thread_current ();
+	struct supplemental_page_table *spt = &t->spt;
+	size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	uint8_t *start = addr;
+	int result = 0;
+
+	if (flags != MS_SYNC && flags != MS_ASYNC)
+		return -1;
+	for (size_t i = 0; i < page_cnt; i++)
+		if (mmap_find_region (start + i * PGSIZE) == NULL)
+			return -1;
+
+	lock_acquire (&spt->lock);
+	if (flags == MS_SYNC) {
+		for (size_t i = 0; i < page_cnt; i++)
+			sync_page (spt_find_page (spt, start + i * PGSIZE));
+
+		/* Then out of the buffer cache, a region at a time. */
+		for (size_t i = 0; i < page_cnt; ) {
+			uint8_t *va = start + i * PGSIZE;
+			struct mmap_region *region = mmap_find_region (va);
+			struct page *page = spt_find_page (spt, va);
+			size_t cnt = region->page_cnt
+				- (va - (uint8_t *) region->addr) / PGSIZE;
+
+			if (cnt > page_cnt - i)
+				cnt = page_cnt - i;
+			if (page != NULL)
+				inode_flush (file_get_inode (region->file), cnt * PGSIZE,
+						page->file.ofs);
+			i += cnt;
+		}
+	} else if (!vm_queue_work (start, page_cnt, sync_page))
+		result = -1;
+	lock_release (&spt->lock);
+	return result;
+}
+
+/* Returns the current process's copy of PARENT, a region of the
+ * process it was forked from, creating it on first use. */
+struct mmap_region *
+mmap_inherit_region (struct mmap_region *parent) {
+	struct mmap_region *region = find_region (parent->addr);
+
+	if (region != NULL)
+		return region;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	region->file = file_reopen (parent->file);
+	if (region->file == NULL) {
+		free (region);
+		return NULL;
+	}
+	region->addr = parent->addr;
+	region->page_cnt = parent->page_cnt;
+	region->advice = parent->advice;
+	list_push_back (&thread_current ()->mmap_list, &region->elem);
+	return region;
+}
+
+/* Returns the current process's mmap() region that contains VA, or a
+ * null pointer if VA is not mapped by mmap(). */
+struct mmap_region *
+mmap_find_region (void *va) {
+	struct list *mmap_list = &thread_current ()->mmap_list;
+
+	for (struct list_elem *e = list_begin (mmap_list);
+			e != list_end (mmap_list); e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		uint8_t *start = region->addr;
+		if ((uint8_t *) va >= start
+				&& (uint8_t *) va < start + region->page_cnt * PGSIZE)
+			return region;
+	}
+	return NULL;
 }
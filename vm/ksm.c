@@ -0,0 +1,376 @@
+/* ksm.c: Same-page merging for anonymous memory.
+ *
+ * A low-priority kernel thread, ksmd, walks the frame table a few
+ * pages at a time.  Each anonymous page it visits is write-protected
+ * and hashed.  If a merged frame with the same contents exists, the
+ * page is remapped to it and its own frame is freed.  Otherwise the
+ * page is remembered in the "unstable" table, and a later page with the
+ * same hash is merged with it into a new merged frame.  Candidates are
+ * always compared byte for byte before merging.  The unstable table is
+ * emptied after every full pass, since its pages may have changed.
+ *
+ * Merged frames are mapped read-only.  A write fault gives the writer a
+ * private copy; eviction unmerges a frame by swapping it out once for
+ * each of its mappers. */
+
+#include "vm/ksm.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* An anonymous frame mapped read-only by pages with equal contents. */
+struct ksm_frame {
+	struct hash_elem elem;       /* Element in stable_table. */
+	uint64_t checksum;           /* Hash of the contents. */
+	struct frame *frame;         /* Frame holding the contents; its rmap
+	                                lists the pages mapping it. */
+	size_t mapper_cnt;           /* Number of pages mapping FRAME. */
+};
+
+/* -ksm-scan: Pages looked at per wakeup; 0 disables merging. */
+size_t ksm_pages_to_scan = 100;
+/* -ksm-sleep: Milliseconds between wakeups. */
+unsigned ksm_sleep_millisecs = 20;
+
+/* Merged frames and candidate pages, both keyed by checksum.
+ * ksm_lock is acquired before frame_lock; eviction only tries it. */
+static struct hash stable_table;
+static struct hash unstable_table;
+static struct lock ksm_lock;
+
+/* Statistics. */
+static size_t pages_scanned;   /* Pages looked at. */
+static size_t full_scans;      /* Passes over the whole frame table. */
+static size_t pages_shared;    /* Merged frames in use. */
+static size_t pages_sharing;   /* Frames saved by merging. */
+static size_t pages_unshared;  /* Merged pages copied on write. */
+
+static void ksmd (void *aux UNUSED);
+static void ksm_scan_page (struct page *page);
+static struct frame *ksm_unmap (struct ksm_frame *ksm, struct page *page);
+static uint64_t stable_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool stable_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED);
+static uint64_t unstable_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool unstable_less (const struct hash_elem *a,
+		const struct hash_elem *b, void *aux UNUSED);
+static void unstable_forget (struct hash_elem *e, void *aux UNUSED);
+
+/* Initializes same-page merging and starts ksmd, unless merging was
+ * disabled on the command line. */
+void
+ksm_init (void) {
+	hash_init (&stable_table, stable_hash, stable_less, NULL);
+	hash_init (&unstable_table, unstable_hash, unstable_less, NULL);
+	lock_init (&ksm_lock);
+
+	if (ksm_pages_to_scan > 0)
+		thread_create ("ksmd", PRI_MIN, ksmd, NULL);
+}
+
+/* Merging daemon. */
+static void
+ksmd (void *aux UNUSED) {
+	int64_t sleep_ticks = (int64_t) ksm_sleep_millisecs * TIMER_FREQ / 1000;
+
+	if (sleep_ticks < 1)
+		sleep_ticks = 1;
+	for (;;) {
+		lock_acquire (&ksm_lock);
+		for (size_t i = 0; i < ksm_pages_to_scan; i++) {
+			bool wrapped;
+			struct page *page = vm_isolate_next (&wrapped);
+
+			if (wrapped) {
+				hash_clear (&unstable_table, unstable_forget);
+				full_scans++;
+			}
+			if (page == NULL)
+				break;
+			ksm_scan_page (page);
+		}
+		lock_release (&ksm_lock);
+		timer_sleep (sleep_ticks);
+	}
+}
+
+/* Adds isolated PAGE to KSM's mappers and frees PAGE's own frame.
+ * Requires ksm_lock. */
+static void
+ksm_map (struct ksm_frame *ksm, struct page *page) {
+	struct frame *old = page->frame;
+
+	vm_rmap_remove (page);
+	vm_rmap_add (ksm->frame, page);
+	page->anon.ksm = ksm;
+	ksm->mapper_cnt++;
+	pages_sharing++;
+	vm_protect_page (page, false);
+	vm_free_frame (old);
+}
+
+/* Returns the merged frame whose contents hash to CHECKSUM, or NULL.
+ * Requires ksm_lock. */
+static struct ksm_frame *
+stable_find (uint64_t checksum) {
+	struct ksm_frame key;
+	struct hash_elem *e;
+
+	key.checksum = checksum;
+	e = hash_find (&stable_table, &key.elem);
+	return e != NULL ? hash_entry (e, struct ksm_frame, elem) : NULL;
+}
+
+/* Tries to merge UNSTABLE, a page seen earlier in this pass, with
+ * isolated PAGE.  Returns true if they were merged.
+ * Requires ksm_lock. */
+static bool
+ksm_merge (struct page *unstable, struct page *page) {
+	struct ksm_frame *ksm;
+
+	if (!vm_isolate_page (unstable))
+		return false;
+	vm_protect_page (unstable, false);
+	if (memcmp (unstable->frame->kva, page->frame->kva, PGSIZE) != 0
+			|| (ksm = malloc (sizeof *ksm)) == NULL) {
+		vm_protect_page (unstable, unstable->writable);
+		vm_putback_page (unstable);
+		return false;
+	}
+
+	hash_delete (&unstable_table, &unstable->anon.unstable_elem);
+	unstable->anon.unstable = false;
+
+	ksm->checksum = page->anon.checksum;
+	ksm->frame = unstable->frame;
+	ksm->frame->ksm = ksm;
+	ksm->mapper_cnt = 1;
+	unstable->anon.ksm = ksm;
+	hash_insert (&stable_table, &ksm->elem);
+	pages_shared++;
+
+	ksm_map (ksm, page);
+	return true;
+}
+
+/* Looks at isolated PAGE and merges it if a page with the same
+ * contents is known.  Requires ksm_lock. */
+static void
+ksm_scan_page (struct page *page) {
+	struct anon_page *anon = &page->anon;
+	struct ksm_frame *ksm;
+	struct hash_elem *e;
+
+	/* Keep the contents stable until we are done. */
+	vm_protect_page (page, false);
+	anon->checksum = hash_bytes (page->frame->kva, PGSIZE);
+	pages_scanned++;
+
+	if (anon->unstable) {
+		hash_delete (&unstable_table, &anon->unstable_elem);
+		anon->unstable = false;
+	}
+
+	/* A merged frame with a colliding hash also keeps PAGE from
+	 * getting one of its own. */
+	ksm = stable_find (anon->checksum);
+	if (ksm != NULL && memcmp (ksm->frame->kva, page->frame->kva,
+				PGSIZE) == 0) {
+		ksm_map (ksm, page);
+		return;
+	}
+
+	e = hash_find (&unstable_table, &anon->unstable_elem);
+	if (e != NULL && ksm == NULL) {
+		struct page *unstable = hash_entry (e, struct page,
+				anon.unstable_elem);
+		if (ksm_merge (unstable, page))
+			return;
+	}
+
+	/* Remember PAGE, in place of any page with the same hash. */
+	e = hash_replace (&unstable_table, &anon->unstable_elem);
+	if (e != NULL)
+		hash_entry (e, struct page, anon.unstable_elem)->anon.unstable = false;
+	anon->unstable = true;
+
+	vm_protect_page (page, page->writable);
+	vm_putback_page (page);
+}
+
+/* Removes PAGE, which is not resident any more, from KSM's mappers.
+ * If KSM has no mappers left, frees it and returns its frame for the
+ * caller to release; if one is left, gives that page the frame back as
+ * its own.  Requires ksm_lock. */
+static struct frame *
+ksm_unmap (struct ksm_frame *ksm, struct page *page) {
+	struct frame *frame = ksm->frame;
+
+	vm_rmap_remove (page);
+	page->anon.ksm = NULL;
+	if (--ksm->mapper_cnt > 0)
+		pages_sharing--;
+	if (ksm->mapper_cnt > 1)
+		return NULL;
+
+	hash_delete (&stable_table, &ksm->elem);
+	frame->ksm = NULL;
+	pages_shared--;
+	if (ksm->mapper_cnt == 1) {
+		struct page *last = list_entry (list_front (&frame->rmap),
+				struct page, rmap_elem);
+		last->anon.ksm = NULL;
+		vm_protect_page (last, last->writable);
+		vm_putback_page (last);
+		frame = NULL;
+	}
+	free (ksm);
+	return frame;
+}
+
+/* Handles a write fault on anonymous PAGE, which is writable but
+ * mapped read-only because ksmd is looking at it or has merged it. */
+bool
+ksm_handle_wp (struct page *page) {
+	struct ksm_frame *ksm;
+
+	lock_acquire (&ksm_lock);
+	ksm = page->anon.ksm;
+	if (ksm == NULL) {
+		/* ksmd gave up on the page while we waited for it. */
+		vm_protect_page (page, true);
+	} else {
+		struct frame *frame = vm_get_frame ();
+		struct frame *old;
+
+		memcpy (frame->kva, ksm->frame->kva, PGSIZE);
+		old = ksm_unmap (ksm, page);
+		if (old != NULL)
+			vm_free_frame (old);
+		pages_unshared++;
+		page->owner->rusage.cow_breaks++;
+
+		vm_rmap_add (frame, page);
+		vm_protect_page (page, true);
+		pml4_set_dirty (page->owner->pml4, page->va, true);
+		vm_putback_page (page);
+	}
+	lock_release (&ksm_lock);
+	return true;
+}
+
+/* Called by the clock algorithm, with frame_lock held, for a merged
+ * FRAME.  If none of its mappers used it recently, swaps it out once
+ * for each mapper, which unmerges them, and returns true; the frame is
+ * then free for reuse.  Gives FRAME another round instead of waiting
+ * if ksmd or a fault holds the tables. */
+bool
+ksm_try_evict (struct frame *frame) {
+	struct ksm_frame *ksm;
+	bool evicted = false;
+
+	if (lock_held_by_current_thread (&ksm_lock)
+			|| !lock_try_acquire (&ksm_lock))
+		return false;
+
+	ksm = frame->ksm;
+	if (ksm != NULL && !vm_rmap_accessed (frame)) {
+		while (!list_empty (&frame->rmap)) {
+			struct page *page = list_entry (list_front (&frame->rmap),
+					struct page, rmap_elem);
+			pml4_clear_page (page->owner->pml4, page->va);
+			if (!swap_out (page))
+				PANIC ("ksm: cannot swap out page %p", page->va);
+			page->anon.ksm = NULL;
+			vm_rmap_remove (page);
+		}
+		hash_delete (&stable_table, &ksm->elem);
+		frame->ksm = NULL;
+		pages_sharing -= ksm->mapper_cnt - 1;
+		pages_shared--;
+		free (ksm);
+		evicted = true;
+	}
+	lock_release (&ksm_lock);
+	return evicted;
+}
+
+/* Unlinks anonymous PAGE, which is being destroyed, from its frame and
+ * from ksmd's tables.  Returns the frame if the caller must free it. */
+struct frame *
+ksm_detach_page (struct page *page) {
+	struct anon_page *anon = &page->anon;
+	struct frame *frame;
+
+	lock_acquire (&ksm_lock);
+	if (anon->unstable) {
+		hash_delete (&unstable_table, &anon->unstable_elem);
+		anon->unstable = false;
+	}
+	if (anon->ksm != NULL) {
+		if (page->owner->pml4 != NULL)
+			pml4_clear_page (page->owner->pml4, page->va);
+		frame = ksm_unmap (anon->ksm, page);
+	} else
+		frame = vm_detach_frame (page);
+	lock_release (&ksm_lock);
+	return frame;
+}
+
+/* Waits until ksmd is done with the pages it has isolated. */
+void
+ksm_wait (void) {
+	lock_acquire (&ksm_lock);
+	lock_release (&ksm_lock);
+}
+
+/* Prints same-page merging statistics. */
+void
+ksm_print_stats (void) {
+	printf ("KSM: %zu pages scanned, %zu full scans, %zu pages shared, "
+			"%zu pages sharing, %zu unshared\n", pages_scanned, full_scans,
+			pages_shared, pages_sharing, pages_unshared);
+}
+
+/* Returns a hash value for the merged frame E belongs to. */
+static uint64_t
+stable_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct ksm_frame, elem)->checksum;
+}
+
+/* Orders merged frames by checksum. */
+static bool
+stable_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct ksm_frame, elem)->checksum
+		< hash_entry (b, struct ksm_frame, elem)->checksum;
+}
+
+/* Returns a hash value for the page E belongs to. */
+static uint64_t
+unstable_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct page, anon.unstable_elem)->anon.checksum;
+}
+
+/* Orders pages by checksum. */
+static bool
+unstable_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct page, anon.unstable_elem)->anon.checksum
+		< hash_entry (b, struct page, anon.unstable_elem)->anon.checksum;
+}
+
+/* Marks the page E belongs to as no longer in the unstable table. */
+static void
+unstable_forget (struct hash_elem *e, void *aux UNUSED) {
+	hash_entry (e, struct page, anon.unstable_elem)->anon.unstable = false;
+}
@@ -0,0 +1,810 @@
+/* share.c: Frames shared between address spaces, and the page cache.
+ *
+ * Every process running an executable sees the same bytes in its
+ * read-only PT_LOAD segments, and file_deny_write() keeps them that way.
+ * Rather than reading a private copy per process, load_segment() maps
+ * such pages through this index, which is keyed by the inode and the
+ * page-aligned offset of the data.  The first process to touch a page
+ * reads it; everyone else maps the same frame read-only.  A text page
+ * that holds the file's bytes as they are, a full page or the last one
+ * of the file, maps the page cache's frame for them read-only, so that
+ * running a program takes no frame besides those of the file's cached
+ * pages.  A text page whose zeroed tail hides bytes of the file needs
+ * a text entry of its own.  A text entry lives as long as it is
+ * mapped: it is created by the first mapper, keeps the inode open and
+ * write-denied, and goes away when the last mapper unmaps it or when
+ * eviction takes the frame from all of its mappers at once.
+ *
+ * The other entries hold file data, and they are the page cache:
+ * read() and write() copy to and from their frames
+ * (filesys/page_cache.c), and mmap() regions map the same frames, so
+ * every process mapping a page of a file sees the others' stores and
+ * those of write() as they happen.  A data entry is read a sector at a
+ * time, as the sectors are needed, and remembers which of its sectors
+ * are valid and which are dirty.  The dirty bits of the mappers are
+ * collected into the entry when they unmap or when msync() asks, and
+ * dirty sectors are written back when the entry is evicted, when
+ * kworkerd finds them old enough, or when the inode is closed for the
+ * last time, which frees all of its cached pages.  Data entries stay
+ * resident after their last mapper is gone, until one of these.
+ *
+ * share_lock is not held across disk I/O.  An entry being read or
+ * written back is marked busy instead, and whoever needs it waits on
+ * share_idle.  Frames are allocated with share_lock released too, so
+ * that eviction can reclaim shared frames meanwhile. */
+
+#include "vm/share.h"
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Sectors in a page, and a sector mask with all of them. */
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+#define ALL_SECTORS ((1 << SECTORS_PER_PAGE) - 1)
+
+/* A resident frame shared by all pages mapping the same file data. */
+struct share_entry {
+	struct hash_elem elem;       /* Element in share_table. */
+	struct inode *inode;         /* Inode the data comes from. */
+	off_t ofs;                   /* Page-aligned offset in INODE. */
+	size_t read_bytes;           /* Text: bytes from INODE; the rest is
+	                                zero.  Data: 0. */
+	bool text;                   /* Executable text, not file data? */
+	struct file *file;           /* Text: own handle on INODE. */
+	struct frame *frame;         /* Frame holding the data; its rmap
+	                                lists the pages mapping it. */
+
+	/* Data only. */
+	uint8_t valid;               /* Sectors holding the file's data. */
+	uint8_t dirty;               /* Sectors to write back. */
+	bool accessed;               /* Copied to or from since the clock
+	                                hand last passed? */
+	int64_t dirty_since;         /* Ticks when DIRTY became nonzero. */
+	struct list_elem dirty_elem; /* Element in dirty_list, if DIRTY, or
+	                                in evicting. */
+	bool busy;                   /* Being read or written back with
+	                                share_lock released? */
+	struct list_elem inode_elem; /* Element in the inode's cached pages;
+	                                for text, in closing. */
+};
+
+static bool share_swap_in (struct page *page, void *kva);
+static bool share_swap_out (struct page *page);
+static void share_destroy (struct page *page);
+
+static const struct page_operations share_ops = {
+	.swap_in = share_swap_in,
+	.swap_out = share_swap_out,
+	.destroy = share_destroy,
+	.type = VM_FILE | VM_SHARED,
+};
+
+/* Shared frame index.  share_lock is acquired before frame_lock;
+ * eviction, which runs with frame_lock held, only ever tries it. */
+static struct hash share_table;
+static struct lock share_lock;
+
+/* Dirty data entries, least recently dirtied first, and their number.
+ * Protected by share_lock. */
+static struct list dirty_list;
+static size_t dirty_cnt;
+
+/* Signaled when an entry stops being busy.  Protected by share_lock. */
+static struct condition share_idle;
+
+/* Released text entries whose files are still to be closed. */
+static struct list closing;
+
+/* Dirty data entries that eviction took the frames of.  Eviction holds
+ * frame_lock, so it cannot take share_lock back after writing them;
+ * they stay in the index without a frame, keeping newer readers away
+ * from the disk, until share_reap() frees them.  Protected by
+ * share_lock. */
+static struct list evicting;
+
+static uint64_t share_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool share_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED);
+static struct frame *share_release (struct share_entry *entry);
+
+/* Initializes the shared frame index. */
+void
+share_init (void) {
+	hash_init (&share_table, share_hash, share_less, NULL);
+	lock_init (&share_lock);
+	cond_init (&share_idle);
+	list_init (&dirty_list);
+	dirty_cnt = 0;
+	list_init (&closing);
+	list_init (&evicting);
+}
+
+/* Frees the entries in evicting, once eviction is done writing them.
+ * Requires share_lock, which eviction only tries, so none is added
+ * while waiting. */
+static void
+share_reap (void) {
+	if (list_empty (&evicting))
+		return;
+
+	vm_wait_eviction ();
+	while (!list_empty (&evicting)) {
+		struct share_entry *entry = list_entry (list_pop_front (&evicting),
+				struct share_entry, dirty_elem);
+
+		hash_delete (&share_table, &entry->elem);
+		list_remove (&entry->inode_elem);
+		free (entry);
+	}
+}
+
+/* Releases share_lock, then closes the files of the text entries
+ * released meanwhile.  Closing the last opener of an inode drops its
+ * cached pages, which takes share_lock, and eviction releases entries
+ * with frame_lock held, so neither can close them right away. */
+static void
+share_unlock (void) {
+	struct list files;
+
+	share_reap ();
+	list_init (&files);
+	while (!list_empty (&closing))
+		list_push_back (&files, list_pop_front (&closing));
+	lock_release (&share_lock);
+
+	while (!list_empty (&files)) {
+		struct share_entry *entry = list_entry (list_pop_front (&files),
+				struct share_entry, inode_elem);
+		file_close (entry->file);
+		free (entry);
+	}
+}
+
+/* Returns the entry for the page of INODE at OFS, or a null pointer if
+ * it is not resident.  READ_BYTES and TEXT are as in struct
+ * share_entry.  Requires share_lock. */
+static struct share_entry *
+share_find (struct inode *inode, off_t ofs, size_t read_bytes, bool text) {
+	struct share_entry key, *entry;
+	struct hash_elem *e;
+
+	key.inode = inode;
+	key.ofs = ofs;
+	key.read_bytes = read_bytes;
+	key.text = text;
+	e = hash_find (&share_table, &key.elem);
+	if (e == NULL)
+		return NULL;
+	entry = hash_entry (e, struct share_entry, elem);
+	if (entry->frame == NULL) {
+		/* Evicted; the data must reach the disk before it is read. */
+		share_reap ();
+		return NULL;
+	}
+	return entry;
+}
+
+/* Returns true if PAGE needs a text entry: executable text that
+ * zeroes bytes of its file, so that it cannot map the page cache's
+ * frame for them. */
+static bool
+share_is_text (struct page *page) {
+	struct file_page *file_page = &page->file;
+
+	return file_page->region == NULL && file_page->read_bytes < PGSIZE
+		&& file_page->ofs + (off_t) file_page->read_bytes
+			< inode_length (file_get_inode (file_page->file));
+}
+
+/* Returns the entry holding the data of PAGE, or a null pointer if
+ * that data is not resident.  Requires share_lock. */
+static struct share_entry *
+share_lookup (struct page *page) {
+	struct file_page *file_page = &page->file;
+	bool text = share_is_text (page);
+
+	return share_find (file_get_inode (file_page->file), file_page->ofs,
+			text ? file_page->read_bytes : 0, text);
+}
+
+/* Initializes ENTRY to hold the page of INODE at OFS in FRAME and adds
+ * it to the index.  Requires share_lock. */
+static void
+share_insert (struct share_entry *entry, struct inode *inode, off_t ofs,
+		size_t read_bytes, bool text, struct frame *frame) {
+	entry->inode = inode;
+	entry->ofs = ofs;
+	entry->read_bytes = read_bytes;
+	entry->text = text;
+	entry->frame = frame;
+	entry->valid = text ? ALL_SECTORS : 0;
+	entry->dirty = 0;
+	entry->accessed = false;
+	entry->busy = false;
+	hash_insert (&share_table, &entry->elem);
+	frame->share = entry;
+}
+
+/* Adds an entry for PAGE's text, which has been read into FRAME.
+ * Returns it, or a null pointer if out of memory.  Requires
+ * share_lock. */
+static struct share_entry *
+text_create (struct page *page, struct frame *frame) {
+	struct share_entry *entry = malloc (sizeof *entry);
+
+	if (entry == NULL)
+		return NULL;
+	entry->file = file_open (inode_reopen (file_get_inode (page->file.file)));
+	if (entry->file == NULL) {
+		free (entry);
+		return NULL;
+	}
+	file_deny_write (entry->file);
+	share_insert (entry, file_get_inode (entry->file), page->file.ofs,
+			page->file.read_bytes, true, frame);
+	return entry;
+}
+
+/* Adds an entry for the page of INODE at OFS in FRAME, with none of its
+ * sectors read yet.  Returns it, or a null pointer if out of memory.
+ * Requires share_lock. */
+static struct share_entry *
+cache_create (struct inode *inode, off_t ofs, struct frame *frame) {
+	struct share_entry *entry = malloc (sizeof *entry);
+
+	if (entry == NULL)
+		return NULL;
+	entry->file = NULL;
+	share_insert (entry, inode, ofs, 0, false, frame);
+	list_push_back (inode_cached_pages (inode), &entry->inode_elem);
+	return entry;
+}
+
+/* Returns the entry for the page of INODE at OFS, once it is not busy,
+ * adding one with none of its sectors read yet if there is none.
+ * Returns a null pointer if out of memory.  Requires share_lock, which
+ * is released while waiting and while getting a frame. */
+static struct share_entry *
+cache_get (struct inode *inode, off_t ofs) {
+	struct share_entry *entry;
+	struct frame *frame = NULL;
+
+	for (;;) {
+		entry = share_find (inode, ofs, 0, false);
+		if (entry != NULL && entry->busy)
+			cond_wait (&share_idle, &share_lock);
+		else if (entry != NULL || frame != NULL)
+			break;
+		else {
+			lock_release (&share_lock);
+			frame = vm_get_frame ();
+			lock_acquire (&share_lock);
+		}
+	}
+
+	if (entry == NULL) {
+		entry = cache_create (inode, ofs, frame);
+		if (entry != NULL)
+			frame = NULL;
+	}
+	if (frame != NULL)
+		vm_free_frame (frame);
+	return entry;
+}
+
+/* Marks ENTRY busy and releases share_lock, for I/O on its frame. */
+static void
+cache_begin_io (struct share_entry *entry) {
+	ASSERT (!entry->busy);
+	entry->busy = true;
+	lock_release (&share_lock);
+}
+
+/* Takes share_lock back after cache_begin_io() and wakes up those
+ * waiting for ENTRY. */
+static void
+cache_end_io (struct share_entry *entry) {
+	lock_acquire (&share_lock);
+	entry->busy = false;
+	cond_broadcast (&share_idle, &share_lock);
+}
+
+/* Makes the SECTORS of ENTRY valid, reading those that are not yet.
+ * Sectors past the end of file are zeroed instead.  Returns true if
+ * anything was read from the disk.  Requires share_lock, which is
+ * released while reading. */
+static bool
+cache_fill (struct share_entry *entry, uint8_t sectors) {
+	off_t length = inode_length (entry->inode);
+	bool read = false;
+
+	sectors &= ~entry->valid;
+	if (sectors == 0)
+		return false;
+
+	cache_begin_io (entry);
+	for (int i = 0; i < SECTORS_PER_PAGE; i++) {
+		uint8_t *kva = (uint8_t *) entry->frame->kva + i * DISK_SECTOR_SIZE;
+		off_t ofs = entry->ofs + i * DISK_SECTOR_SIZE;
+		off_t n = 0;
+
+		if (!(sectors & (1 << i)))
+			continue;
+		if (ofs < length) {
+			n = inode_read_direct (entry->inode, kva, DISK_SECTOR_SIZE, ofs);
+			read = true;
+		}
+		memset (kva + n, 0, DISK_SECTOR_SIZE - n);
+	}
+	cache_end_io (entry);
+
+	entry->valid |= sectors;
+	if (read)
+		thread_current ()->page_ins++;
+	return read;
+}
+
+/* Marks the SECTORS of ENTRY dirty.  Requires share_lock. */
+static void
+cache_set_dirty (struct share_entry *entry, uint8_t sectors) {
+	if (entry->dirty == 0 && sectors != 0) {
+		entry->dirty_since = timer_ticks ();
+		list_push_back (&dirty_list, &entry->dirty_elem);
+		dirty_cnt++;
+	}
+	entry->dirty |= sectors;
+}
+
+/* Marks ENTRY clean and returns the sectors that were dirty.  Requires
+ * share_lock. */
+static uint8_t
+cache_clean (struct share_entry *entry) {
+	uint8_t dirty = entry->dirty;
+
+	if (dirty != 0) {
+		entry->dirty = 0;
+		list_remove (&entry->dirty_elem);
+		dirty_cnt--;
+	}
+	return dirty;
+}
+
+/* Writes the SECTORS of the page of INODE at OFS, held at KVA, that
+ * are within the file back to the disk. */
+static void
+cache_write (struct inode *inode, off_t ofs, const uint8_t *kva,
+		uint8_t sectors) {
+	off_t length = inode_length (inode);
+
+	for (int i = 0; i < SECTORS_PER_PAGE; i++)
+		if ((sectors & (1 << i)) && ofs + i * DISK_SECTOR_SIZE < length)
+			inode_write_direct (inode, kva + i * DISK_SECTOR_SIZE,
+					DISK_SECTOR_SIZE, ofs + i * DISK_SECTOR_SIZE);
+}
+
+/* Writes the dirty sectors of ENTRY that are within its file back to
+ * the disk.  Sectors dirtied meanwhile are written back later.
+ * Requires share_lock, which is released while writing. */
+static void
+cache_write_back (struct share_entry *entry) {
+	uint8_t sectors = cache_clean (entry);
+
+	if (sectors == 0)
+		return;
+	cache_begin_io (entry);
+	cache_write (entry->inode, entry->ofs, entry->frame->kva, sectors);
+	cache_end_io (entry);
+}
+
+/* Maps ENTRY's frame into PAGE's address space.  Requires share_lock. */
+static bool
+share_map (struct share_entry *entry, struct page *page) {
+	if (!pml4_set_page (page->owner->pml4, page->va, entry->frame->kva,
+				page->writable))
+		return false;
+	vm_rmap_add (entry->frame, page);
+	page->file.share = entry;
+	return true;
+}
+
+/* Removes PAGE from ENTRY's mappers and unmaps it, remembering
+ * whether PAGE wrote to the frame.  Requires share_lock. */
+static void
+share_unmap (struct share_entry *entry, struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+
+	vm_rmap_remove (page);
+	if (pml4 != NULL) {
+		if (pml4_is_dirty (pml4, page->va))
+			cache_set_dirty (entry, ALL_SECTORS);
+		pml4_clear_page (pml4, page->va);
+	}
+	page->file.share = NULL;
+}
+
+/* Adds a page at UPAGE to the current process that holds READ_BYTES
+ * bytes of FILE at OFS followed by zeros.  REGION is the mmap() region
+ * the page belongs to, or a null pointer for executable text, which is
+ * always read-only.  If that data is already resident, its frame is
+ * mapped right away; otherwise the page is read on its first fault. */
+bool
+share_alloc_page (void *upage, struct file *file, off_t ofs,
+		size_t read_bytes, bool writable, struct mmap_region *region) {
+	struct thread *t = thread_current ();
+	struct share_entry *entry;
+	struct page *page;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (ofs % PGSIZE == 0);
+	ASSERT (region != NULL || !writable);
+
+	if (spt_find_page (&t->spt, upage) != NULL)
+		return false;
+	page = malloc (sizeof *page);
+	if (page == NULL)
+		return false;
+
+	page->operations = &share_ops;
+	page->va = upage;
+	page->frame = NULL;
+	page->owner = t;
+	page->writable = writable;
+	memset (&page->file, 0, sizeof page->file);
+	page->file.file = file;
+	page->file.ofs = ofs;
+	page->file.read_bytes = read_bytes;
+	page->file.region = region;
+	if (!spt_insert_page (&t->spt, page)) {
+		free (page);
+		return false;
+	}
+
+	lock_acquire (&share_lock);
+	entry = share_lookup (page);
+	if (entry != NULL && entry->valid == ALL_SECTORS)
+		share_map (entry, page);
+	share_unlock ();
+	return true;
+}
+
+/* Brings PAGE into memory, reading it only if its data is not
+ * resident already. */
+bool
+share_claim_page (struct page *page) {
+	struct file_page *file_page = &page->file;
+	bool text = share_is_text (page);
+	struct share_entry *entry;
+	struct frame *frame = NULL, *stale = NULL;
+	bool success = false;
+
+	lock_acquire (&share_lock);
+	if (text) {
+		entry = share_lookup (page);
+		while (entry == NULL && frame == NULL) {
+			/* Text is read through the page cache, which takes
+			 * share_lock, so read it unlocked and index it afterwards,
+			 * unless another process gets there first. */
+			lock_release (&share_lock);
+			frame = vm_get_frame ();
+			if (!swap_in (page, frame->kva)) {
+				vm_free_frame (frame);
+				return false;
+			}
+			lock_acquire (&share_lock);
+			entry = share_lookup (page);
+		}
+		if (entry == NULL) {
+			entry = text_create (page, frame);
+			if (entry != NULL)
+				frame = NULL;
+		}
+	} else {
+		entry = cache_get (file_get_inode (file_page->file), file_page->ofs);
+		if (entry != NULL)
+			cache_fill (entry, ALL_SECTORS);
+	}
+	if (entry == NULL)
+		goto done;
+	success = share_map (entry, page);
+	if (!success && text && list_empty (&entry->frame->rmap))
+		stale = share_release (entry);
+
+done:
+	share_unlock ();
+	if (frame != NULL)
+		vm_free_frame (frame);
+	if (stale != NULL)
+		vm_free_frame (stale);
+	return success;
+}
+
+/* Takes ENTRY out of the index after its last mapper is gone and
+ * returns its frame, which the caller must pass to vm_free_frame()
+ * unless it is reusing it.  Data must have been written back.
+ * Requires share_lock. */
+static struct frame *
+share_release (struct share_entry *entry) {
+	struct frame *frame = entry->frame;
+
+	ASSERT (list_empty (&frame->rmap));
+	ASSERT (!entry->busy && entry->dirty == 0);
+	hash_delete (&share_table, &entry->elem);
+	frame->share = NULL;
+	if (entry->text) {
+		file_allow_write (entry->file);
+		list_push_back (&closing, &entry->inode_elem);
+	} else {
+		list_remove (&entry->inode_elem);
+		free (entry);
+	}
+	return frame;
+}
+
+/* Called by the clock algorithm, with frame_lock held, for a shared
+ * FRAME.  If the data was not used recently, by a mapper or through
+ * the page cache, unmaps it from every mapper, writes it back if
+ * needed and returns true; the frame is then free for reuse.  Gives
+ * FRAME another round instead of waiting if the index or the entry is
+ * busy. */
+bool
+share_try_evict (struct frame *frame) {
+	struct share_entry *entry;
+	struct inode *inode = NULL;
+	off_t ofs = 0;
+	uint8_t dirty = 0;
+	bool evicted = false;
+
+	if (lock_held_by_current_thread (&share_lock)
+			|| !lock_try_acquire (&share_lock))
+		return false;
+
+	entry = frame->share;
+	if (entry != NULL && !entry->busy) {
+		bool accessed = vm_rmap_accessed (frame) || entry->accessed;
+
+		entry->accessed = false;
+		if (!accessed) {
+			while (!list_empty (&frame->rmap))
+				share_unmap (entry, list_entry (list_front (&frame->rmap),
+							struct page, rmap_elem));
+			if (entry->dirty == 0)
+				share_release (entry);
+			else {
+				/* Written back below, with share_lock released. */
+				inode = entry->inode;
+				ofs = entry->ofs;
+				dirty = cache_clean (entry);
+				entry->frame = NULL;
+				frame->share = NULL;
+				list_push_back (&evicting, &entry->dirty_elem);
+			}
+			evicted = true;
+		}
+	}
+	lock_release (&share_lock);
+
+	if (dirty != 0)
+		cache_write (inode, ofs, frame->kva, dirty);
+	return evicted;
+}
+
+/* Writes PAGE's data back to its file now if any mapper modified it
+ * since it was last written, instead of when the data leaves memory.
+ * Stores made while the data is being written mark it dirty again. */
+void
+share_sync_page (struct page *page) {
+	struct share_entry *entry;
+
+	lock_acquire (&share_lock);
+	while ((entry = page->file.share) != NULL && entry->busy)
+		cond_wait (&share_idle, &share_lock);
+	if (entry != NULL) {
+		if (vm_rmap_dirty (entry->frame))
+			cache_set_dirty (entry, ALL_SECTORS);
+		cache_write_back (entry);
+	}
+	share_unlock ();
+}
+
+/* Copies SIZE bytes between BUFFER and the cached data of INODE at
+ * OFS, which must lie within one page: into the cache if WRITE, out of
+ * it otherwise.  Reads the sectors needed that are not cached yet,
+ * except those that WRITE overwrites up to the end of file.  Sets *HIT
+ * to true if nothing had to be read.  Returns false if out of
+ * memory. */
+bool
+share_cache_rw (struct inode *inode, off_t ofs, void *buffer, size_t size,
+		bool write, bool *hit) {
+	off_t page_ofs = ofs % PGSIZE;
+	off_t base = ofs - page_ofs;
+	off_t end = page_ofs + size;
+	off_t eof = inode_length (inode) - base;
+	uint8_t *kva;
+	uint8_t sectors = 0, fill = 0;
+	struct share_entry *entry;
+
+	ASSERT (end <= PGSIZE);
+
+	lock_acquire (&share_lock);
+	entry = cache_get (inode, base);
+	if (entry == NULL) {
+		share_unlock ();
+		return false;
+	}
+
+	for (int i = 0; i < SECTORS_PER_PAGE; i++) {
+		off_t start = i * DISK_SECTOR_SIZE;
+		off_t stop = start + DISK_SECTOR_SIZE < eof
+			? start + DISK_SECTOR_SIZE : eof;
+
+		if (page_ofs >= start + DISK_SECTOR_SIZE || end <= start)
+			continue;
+		sectors |= 1 << i;
+		if (write && page_ofs <= start && end >= stop
+				&& !(entry->valid & (1 << i))) {
+			memset ((uint8_t *) entry->frame->kva + start, 0,
+					DISK_SECTOR_SIZE);
+			entry->valid |= 1 << i;
+		} else
+			fill |= 1 << i;
+	}
+	*hit = !cache_fill (entry, fill);
+
+	kva = (uint8_t *) entry->frame->kva + page_ofs;
+	if (write) {
+		memcpy (kva, buffer, size);
+		cache_set_dirty (entry, sectors);
+	} else
+		memcpy (buffer, kva, size);
+	entry->accessed = true;
+	share_unlock ();
+	return true;
+}
+
+/* Returns true if the page of INODE at page-aligned OFS is in the page
+ * cache. */
+bool
+share_cached (struct inode *inode, off_t ofs) {
+	bool cached;
+
+	lock_acquire (&share_lock);
+	cached = share_find (inode, ofs, 0, false) != NULL;
+	share_unlock ();
+	return cached;
+}
+
+/* Reads all of the page of INODE at page-aligned OFS into the page
+ * cache, if it is not there yet. */
+void
+share_cache_fetch (struct inode *inode, off_t ofs) {
+	struct share_entry *entry;
+
+	lock_acquire (&share_lock);
+	entry = cache_get (inode, ofs);
+	if (entry != NULL)
+		cache_fill (entry, ALL_SECTORS);
+	share_unlock ();
+}
+
+/* Returns the number of dirty pages in the page cache. */
+size_t
+share_dirty_cnt (void) {
+	return dirty_cnt;
+}
+
+/* Writes back the cached pages that have been dirty for AGE ticks or
+ * more, oldest first, and then more until at most LIMIT are dirty. */
+void
+share_writeback (int64_t age, size_t limit) {
+	lock_acquire (&share_lock);
+	while (!list_empty (&dirty_list)) {
+		struct share_entry *entry = list_entry (list_front (&dirty_list),
+				struct share_entry, dirty_elem);
+
+		if (dirty_cnt <= limit && timer_elapsed (entry->dirty_since) < age)
+			break;
+		if (entry->busy)
+			cond_wait (&share_idle, &share_lock);
+		else
+			cache_write_back (entry);
+	}
+	share_unlock ();
+}
+
+/* Frees the cached pages of INODE, which nobody has open any more,
+ * writing back their dirty sectors first if WRITE_BACK. */
+void
+share_cache_drop (struct inode *inode, bool write_back) {
+	struct list *pages = inode_cached_pages (inode);
+
+	lock_acquire (&share_lock);
+	while (!list_empty (pages)) {
+		struct share_entry *entry = list_entry (list_front (pages),
+				struct share_entry, inode_elem);
+
+		if (entry->frame == NULL)
+			share_reap ();
+		else if (entry->busy)
+			cond_wait (&share_idle, &share_lock);
+		else if (write_back && entry->dirty != 0)
+			cache_write_back (entry);
+		else {
+			cache_clean (entry);
+			vm_free_frame (share_release (entry));
+		}
+	}
+	share_unlock ();
+}
+
+/* Reads the page's text into KVA. */
+static bool
+share_swap_in (struct page *page, void *kva) {
+	struct file_page *file_page = &page->file;
+
+	if (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->ofs) != (off_t) file_page->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return true;
+}
+
+/* Shared frames are written back by share_release() once all of their
+ * mappers are gone, so there is nothing to save per page. */
+static bool
+share_swap_out (struct page *page UNUSED) {
+	return true;
+}
+
+/* Unmaps PAGE from its shared frame.  Text is freed along with its
+ * last mapper; data stays in the page cache. */
+static void
+share_destroy (struct page *page) {
+	struct share_entry *entry;
+	struct frame *frame = NULL;
+
+	lock_acquire (&share_lock);
+	entry = page->file.share;
+	if (entry != NULL) {
+		share_unmap (entry, page);
+		if (entry->text && list_empty (&entry->frame->rmap))
+			frame = share_release (entry);
+	}
+	share_unlock ();
+
+	if (frame != NULL)
+		vm_free_frame (frame);
+}
+
+/* Returns a hash value for the entry that E belongs to. */
+static uint64_t
+share_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct share_entry *entry = hash_entry (e, struct share_entry, elem);
+	return hash_bytes (&entry->inode, sizeof entry->inode)
+		^ hash_int (entry->ofs) ^ hash_int (entry->read_bytes)
+		^ entry->text;
+}
+
+/* Orders entries by inode, offset, length and kind. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct share_entry *a = hash_entry (a_, struct share_entry, elem);
+	const struct share_entry *b = hash_entry (b_, struct share_entry, elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	if (a->read_bytes != b->read_bytes)
+		return a->read_bytes < b->read_bytes;
+	return a->text < b->text;
+}
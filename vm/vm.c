@@ -1,8 +1,68 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "filesys/page_cache.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/ksm.h"
+#include "vm/share.h"
+
+/* Frame table.  Holds every frame handed out from the user pool, in
+ * the order the clock hand visits them. */
+static struct list frame_table;
+static struct lock frame_lock;
+static struct list_elem *clock_hand;
+/* Next frame for vm_isolate_next() to look at. */
+static struct list_elem *scan_hand;
+
+/* -low-wmark, -high-wmark: kswapd wakes up when fewer than
+ * vm_low_wmark user pages are free and reclaims frames until
+ * vm_high_wmark are.  A low watermark of 0 disables kswapd. */
+size_t vm_low_wmark = 16;
+size_t vm_high_wmark = 32;
+
+static struct semaphore kswapd_sema;  /* Upped to wake kswapd. */
+static bool kswapd_awake;             /* Protected by frame_lock. */
+
+/* A range of a process's pages queued for vmworkd, and what to do with
+ * each of them. */
+struct vm_work {
+	struct list_elem elem;       /* Element in work_queue. */
+	struct thread *owner;        /* Process owning the pages. */
+	uint8_t *addr;               /* First page. */
+	size_t page_cnt;             /* Number of pages. */
+	vm_work_func *func;          /* Applied to each page. */
+};
+
+static struct list work_queue;        /* Work queued for vmworkd. */
+static struct lock work_lock;         /* Protects work_queue. */
+static struct semaphore work_sema;    /* Upped for each work queued. */
+
+/* Statistics. */
+static size_t direct_reclaims;        /* Frames evicted in faults. */
+static size_t background_reclaims;    /* Frames evicted by kswapd. */
+static size_t limit_reclaims;         /* Frames taken from processes at
+                                         their resident memory limit. */
+
+/* Pages read ahead of a fault in an MADV_SEQUENTIAL region. */
+#define READAHEAD_PAGES 16
+
+static void kswapd (void *aux UNUSED);
+static void vmworkd (void *aux UNUSED);
+static void inspect_fault_cnt (struct intr_frame *f);
+
+static uint64_t page_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool page_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED);
+static void page_destructor (struct hash_elem *e, void *aux UNUSED);
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -10,12 +70,49 @@ void
 vm_init (void) {
 	vm_anon_init ();
 	vm_file_init ();
-#ifdef EFILESYS  /* For project 4 */
-	pagecache_init ();
-#endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&frame_table);
+	lock_init (&frame_lock);
+	clock_hand = NULL;
+	scan_hand = NULL;
+	share_init ();
+	ksm_init ();
+	pagecache_init ();
+
+	sema_init (&kswapd_sema, 0);
+	kswapd_awake = false;
+	if (vm_high_wmark < vm_low_wmark)
+		vm_high_wmark = vm_low_wmark;
+	if (vm_low_wmark > 0)
+		thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL);
+
+	/* vmworkd runs ahead of the processes, so that the pages it brings
+	 * in are there before they fault on them. */
+	list_init (&work_queue);
+	lock_init (&work_lock);
+	sema_init (&work_sema, 0);
+	thread_create ("vmworkd", PRI_DEFAULT + 1, vmworkd, NULL);
+
+	intr_register_int (0x45, 3, INTR_OFF, inspect_fault_cnt,
+			"Inspect Page Fault Count");
+}
+
+/* Tool for testing madvise().  Calling this function via int 0x45.
+ * Output:
+ *   @RAX - Number of page faults taken by the current process. */
+static void
+inspect_fault_cnt (struct intr_frame *f) {
+	struct rusage *usage = &thread_current ()->rusage;
+	f->R.rax = usage->minor_faults + usage->major_faults;
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	printf ("Reclaim: %zu direct, %zu background, %zu over limit\n",
+			direct_reclaims, background_reclaims, limit_reclaims);
+	ksm_print_stats ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,9 +130,9 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (struct thread *owner);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static struct frame *vm_evict_frame (struct thread *owner);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -50,11 +147,32 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
+
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
 
-		/* TODO: Insert the page into the spt. */
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->owner = thread_current ();
+		page->writable = writable;
+
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,82 +180,694 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page p;
+	struct hash_elem *e;
 
-	return page;
+	p.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &p.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
-
-	return succ;
+spt_insert_page (struct supplemental_page_table *spt,
+		struct page *page) {
+	return hash_insert (&spt->pages, &page->spt_elem) == NULL;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->pages, &page->spt_elem);
 	vm_dealloc_page (page);
-	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns true if PAGE belongs to an mmap() region advised
+ * MADV_SEQUENTIAL. */
+static bool
+is_sequential (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_FILE
+		&& page->file.region != NULL
+		&& page->file.region->advice == MADV_SEQUENTIAL;
+}
+
+/* Links FRAME to PAGE, or unlinks it if PAGE is null, keeping the
+ * owners' counts of evictable frames.  Must be called with frame_lock
+ * held. */
+static void
+frame_set_page (struct frame *frame, struct page *page) {
+	if (frame->page != NULL)
+		frame->page->owner->rss--;
+	if (page != NULL) {
+		page->owner->rss++;
+		frame->credit = page->owner->reclaim_prio;
+	}
+	frame->page = page;
+}
+
+/* Returns true if OWNER may not have another frame of its own without
+ * giving one up. */
+static bool
+over_rss_limit (struct thread *owner) {
+	return owner->rss_limit > 0 && owner->rss >= owner->rss_limit;
+}
+
+/* Get the struct frame, that will be evicted.
+ * Runs the clock algorithm over the frame table: a frame whose page
+ * was accessed since the hand last passed gets its accessed bit
+ * cleared and a second chance.  A frame of a process with reclaim
+ * priority P is also passed over P more times after its last access,
+ * so low-priority processes lose their pages first.  If OWNER is not
+ * null, only OWNER's own frames are considered, and priority does not
+ * matter.  Must be called with frame_lock held. */
+static struct frame *
+vm_get_victim (struct thread *owner) {
+	size_t sweep = (RECLAIM_PRIO_MAX + 2) * list_size (&frame_table);
+
+	for (size_t i = 0; i < sweep; i++) {
+		if (clock_hand == NULL || clock_hand == list_end (&frame_table))
+			clock_hand = list_begin (&frame_table);
+		struct frame *frame = list_entry (clock_hand, struct frame, elem);
+		clock_hand = list_next (clock_hand);
+
+		/* A system call is copying to or from the frame. */
+		if (frame->pin_cnt > 0)
+			continue;
+		if (owner != NULL && (frame->page == NULL
+					|| frame->page->owner != owner))
+			continue;
+
+		/* Shared frames are unmapped from all of their mappers at
+		 * once, or not at all. */
+		if (frame->share != NULL) {
+			if (share_try_evict (frame))
+				return frame;
+			continue;
+		}
+		if (frame->ksm != NULL) {
+			if (ksm_try_evict (frame))
+				return frame;
+			continue;
+		}
+
+		/* Frame is being set up or torn down. */
+		struct page *page = frame->page;
+		if (page == NULL)
+			continue;
+
+		if (vm_rmap_accessed (frame)) {
+			frame->credit = page->owner->reclaim_prio;
+			continue;
+		}
+		if (owner == NULL && frame->credit > 0) {
+			frame->credit--;
+			continue;
+		}
+		return frame;
+	}
+	return NULL;
+}
+
+/* Evict one page, of OWNER if it is not null, and return the
+ * corresponding frame.
+ * Return NULL on error.
+ * Must be called with frame_lock held. */
 static struct frame *
-vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+vm_evict_frame (struct thread *owner) {
+	struct frame *victim = vm_get_victim (owner);
+	if (victim == NULL)
+		return NULL;
 
+	struct page *page = victim->page;
+	if (page != NULL) {
+		/* Unmap first so the owner cannot modify the page while it
+		 * is being written out; a fault on it waits for us in
+		 * vm_try_handle_fault(). */
+		pml4_clear_page (page->owner->pml4, page->va);
+		if (!swap_out (page))
+			PANIC ("vm: cannot swap out page %p", page->va);
+		vm_rmap_remove (page);
+		frame_set_page (victim, NULL);
+	}
+	ASSERT (list_empty (&victim->rmap));
 	return victim;
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+/* Removes FRAME from the frame table.  Must be called with frame_lock
+ * held. */
+static void
+frame_table_remove (struct frame *frame) {
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	if (scan_hand == &frame->elem)
+		scan_hand = list_next (scan_hand);
+	list_remove (&frame->elem);
+}
+
+/* Wakes up kswapd if free user memory fell below the low watermark.
+ * Must be called with frame_lock held. */
+static void
+wakeup_kswapd (void) {
+	if (vm_low_wmark > 0 && !kswapd_awake
+			&& palloc_user_free_cnt () < vm_low_wmark) {
+		kswapd_awake = true;
+		sema_up (&kswapd_sema);
+	}
+}
+
+/* Background reclaim thread.  Evicts frames, one at a time so that
+ * faults are not held up for long, until the high watermark of free
+ * user pages is reached. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&kswapd_sema);
+
+		while (palloc_user_free_cnt () < vm_high_wmark) {
+			struct frame *frame;
+
+			lock_acquire (&frame_lock);
+			frame = vm_evict_frame (NULL);
+			if (frame != NULL) {
+				frame_table_remove (frame);
+				background_reclaims++;
+			}
+			lock_release (&frame_lock);
+
+			if (frame == NULL)
+				break;
+			palloc_free_page (frame->kva);
+			free (frame);
+		}
+
+		lock_acquire (&frame_lock);
+		kswapd_awake = false;
+		lock_release (&frame_lock);
+	}
+}
+
+/* Returns a frame for a page of OWNER, or for any process if OWNER
+ * is null.  An OWNER at its resident memory limit gets one of its own
+ * frames back, unless it has none that can be evicted. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+get_frame (struct thread *owner) {
+	struct frame *frame = NULL;
+	void *kva = NULL;
 
-	return NULL;
+	if (owner != NULL && over_rss_limit (owner)) {
+		lock_acquire (&frame_lock);
+		frame = vm_evict_frame (owner);
+		if (frame != NULL)
+			limit_reclaims++;
+		lock_release (&frame_lock);
+	}
+	if (frame == NULL)
+		kva = palloc_get_page (PAL_USER);
+
+	lock_acquire (&frame_lock);
+	if (kva != NULL) {
+		frame = malloc (sizeof *frame);
+		if (frame == NULL)
+			PANIC ("vm: out of memory for frame table");
+		frame->kva = kva;
+		list_init (&frame->rmap);
+		list_push_back (&frame_table, &frame->elem);
+	} else if (frame == NULL) {
+		frame = vm_evict_frame (NULL);
+		if (frame == NULL)
+			PANIC ("vm: out of frames with nothing to evict");
+		direct_reclaims++;
+	}
+	wakeup_kswapd ();
+	frame->page = NULL;
+	frame->share = NULL;
+	frame->ksm = NULL;
+	frame->pin_cnt = 0;
+	lock_release (&frame_lock);
+
+	ASSERT (frame != NULL);
+	ASSERT (frame->page == NULL);
+	return frame;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
-static struct frame *
+ * space.
+ * The frame stays invisible to eviction until a page or shared index
+ * entry is linked to it. */
+struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	return get_frame (NULL);
+}
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+/* Unlinks PAGE from its frame, if it has one, and unmaps it.
+ * Returns the frame, which stays out of eviction's reach until the
+ * caller releases it with vm_free_frame(), or NULL if PAGE was not
+ * resident. */
+struct frame *
+vm_detach_frame (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		if (frame->page == page)
+			frame_set_page (frame, NULL);
+		vm_rmap_remove (page);
+	}
+	lock_release (&frame_lock);
+
+	if (frame != NULL && page->owner->pml4 != NULL)
+		pml4_clear_page (page->owner->pml4, page->va);
 	return frame;
 }
 
+/* Removes FRAME from the frame table and returns its memory to the
+ * user pool. */
+void
+vm_free_frame (struct frame *frame) {
+	ASSERT (list_empty (&frame->rmap));
+
+	lock_acquire (&frame_lock);
+	frame_table_remove (frame);
+	lock_release (&frame_lock);
+
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
+/* Waits for the eviction in progress, if any, to finish.  Eviction
+ * holds frame_lock throughout, including while it writes a frame out
+ * with other locks released. */
+void
+vm_wait_eviction (void) {
+	lock_acquire (&frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Takes the next resident anonymous page, in frame table order, out of
+ * eviction's reach and returns it, or returns NULL if there is none.
+ * Sets *WRAPPED if the scan went past the end of the frame table.
+ * The caller must give the page back with vm_putback_page() unless it
+ * moves the page to another frame. */
+struct page *
+vm_isolate_next (bool *wrapped) {
+	struct page *found = NULL;
+	size_t cnt;
+
+	*wrapped = false;
+	lock_acquire (&frame_lock);
+	cnt = list_size (&frame_table);
+	for (size_t i = 0; i < cnt && found == NULL; i++) {
+		if (scan_hand == NULL || scan_hand == list_end (&frame_table)) {
+			scan_hand = list_begin (&frame_table);
+			*wrapped = true;
+		}
+		struct frame *frame = list_entry (scan_hand, struct frame, elem);
+		struct page *page = frame->page;
+		scan_hand = list_next (scan_hand);
+
+		if (page != NULL && VM_TYPE (page->operations->type) == VM_ANON
+				&& page->anon.ksm == NULL && frame->pin_cnt == 0) {
+			frame_set_page (frame, NULL);
+			found = page;
+		}
+	}
+	lock_release (&frame_lock);
+	return found;
+}
+
+/* Takes resident PAGE out of eviction's reach, as vm_isolate_next()
+ * does.  Returns false if PAGE is not resident, already isolated or
+ * pinned. */
+bool
+vm_isolate_page (struct page *page) {
+	bool success = false;
+
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL && page->frame->page == page
+			&& page->frame->pin_cnt == 0) {
+		frame_set_page (page->frame, NULL);
+		success = true;
+	}
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Makes isolated PAGE's frame a candidate for eviction again. */
+void
+vm_putback_page (struct page *page) {
+	lock_acquire (&frame_lock);
+	frame_set_page (page->frame, page);
+	lock_release (&frame_lock);
+}
+
+/* Maps PAGE to its frame, read/write if WRITABLE and read-only
+ * otherwise, keeping the accessed and dirty bits.  Does nothing if
+ * PAGE is not resident. */
+void
+vm_protect_page (struct page *page, bool writable) {
+	uint64_t *pml4 = page->owner->pml4;
+
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL && pml4 != NULL) {
+		bool accessed = pml4_is_accessed (pml4, page->va);
+		bool dirty = pml4_is_dirty (pml4, page->va);
+
+		/* The entry stays present throughout, so that munmap() never
+		 * sees its page table empty; setting the bits flushes the TLB. */
+		pml4_set_page (pml4, page->va, page->frame->kva, writable);
+		pml4_set_accessed (pml4, page->va, accessed);
+		pml4_set_dirty (pml4, page->va, dirty);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Reverse mapping.
+ * Every frame keeps the list of pages that map it, its rmap, so that
+ * the (pml4, va) pairs to visit when the frame is aged, written back or
+ * taken away are found in time proportional to the number of mappers.
+ * A private frame has one mapper; a shared or merged frame has one per
+ * process.  The rmap of an evictable private frame is protected by
+ * frame_lock; that of a shared, merged or isolated frame by the lock of
+ * its holder, share_lock or ksm_lock. */
+
+/* Adds PAGE, which is not resident, to FRAME's mappers. */
+void
+vm_rmap_add (struct frame *frame, struct page *page) {
+	ASSERT (page->frame == NULL);
+
+	list_push_back (&frame->rmap, &page->rmap_elem);
+	page->frame = frame;
+}
+
+/* Removes PAGE from its frame's mappers.  Leaves its page table entry
+ * to the caller. */
+void
+vm_rmap_remove (struct page *page) {
+	ASSERT (page->frame != NULL);
+
+	list_remove (&page->rmap_elem);
+	page->frame = NULL;
+}
+
+/* Returns true if any mapper of FRAME accessed it since the last
+ * check, clearing the accessed bits.  Accesses through an
+ * MADV_SEQUENTIAL region do not count. */
+bool
+vm_rmap_accessed (struct frame *frame) {
+	bool accessed = false;
+
+	for (struct list_elem *e = list_begin (&frame->rmap);
+			e != list_end (&frame->rmap); e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, rmap_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (pml4 == NULL || is_sequential (page))
+			continue;
+		if (pml4_is_accessed (pml4, page->va)) {
+			pml4_set_accessed (pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if any mapper of FRAME wrote to it since the last
+ * check, clearing the dirty bits. */
+bool
+vm_rmap_dirty (struct frame *frame) {
+	bool dirty = false;
+
+	for (struct list_elem *e = list_begin (&frame->rmap);
+			e != list_end (&frame->rmap); e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, rmap_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (pml4 != NULL && pml4_is_dirty (pml4, page->va)) {
+			pml4_set_dirty (pml4, page->va, false);
+			dirty = true;
+		}
+	}
+	return dirty;
+}
+
 /* Growing the stack. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+vm_stack_growth (void *addr) {
+	void *upage = pg_round_down (addr);
+
+	if (vm_alloc_page (VM_ANON | VM_STACK, upage, true))
+		vm_claim_page (upage);
 }
 
 /* Handle the fault on write_protected page */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	if (!page->writable)
+		return false;
+	/* Anonymous pages are write-protected while the merging daemon
+	 * looks at them and after they were merged. */
+	if (VM_TYPE (page->operations->type) == VM_ANON)
+		return ksm_handle_wp (page);
+	return false;
+}
+
+/* Returns true if a fault at ADDR with user stack pointer RSP looks
+ * like an access to a not yet allocated part of the stack. */
+static bool
+is_stack_access (void *addr, void *rsp) {
+	return (uint8_t *) addr >= (uint8_t *) rsp - 8
+		&& (uint8_t *) addr < (uint8_t *) USER_STACK
+		&& (uint8_t *) addr >= (uint8_t *) USER_STACK - STACK_LIMIT;
+}
+
+/* Brings in up to READAHEAD_PAGES pages following PAGE, which was
+ * just claimed, if PAGE is in an MADV_SEQUENTIAL region.
+ * Must be called with the SPT lock held. */
+static void
+vm_readahead (struct supplemental_page_table *spt, struct page *page) {
+	struct mmap_region *region;
+	uint8_t *end;
+
+	if (!is_sequential (page))
+		return;
+	region = page->file.region;
+	end = (uint8_t *) region->addr + region->page_cnt * PGSIZE;
+	for (int i = 1; i <= READAHEAD_PAGES; i++) {
+		uint8_t *va = (uint8_t *) page->va + i * PGSIZE;
+		struct page *next;
+
+		if (va >= end)
+			break;
+		next = spt_find_page (spt, va);
+		if (next != NULL && next->frame == NULL && !vm_do_claim_page (next))
+			break;
+	}
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct thread *t = thread_current ();
+	struct supplemental_page_table *spt = &t->spt;
 	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+	bool success, major = false;
 
-	return vm_do_claim_page (page);
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	if (!not_present) {
+		page = spt_find_page (spt, addr);
+		success = page != NULL && write && vm_handle_wp (page);
+		if (success)
+			t->rusage.minor_faults++;
+		return success;
+	}
+
+	lock_acquire (&spt->lock);
+	page = spt_find_page (spt, addr);
+	if (page == NULL) {
+		/* Faults taken inside a system call see the kernel's rsp, so
+		 * use the one saved on entry. */
+		void *rsp = user ? (void *) f->rsp : t->user_rsp;
+		success = is_stack_access (addr, rsp);
+		if (success) {
+			vm_stack_growth (addr);
+			success = spt_find_page (spt, addr) != NULL;
+		}
+	} else if (write && !page->writable)
+		success = false;
+	else {
+		/* Eviction unmaps a page before writing it out and drops its
+		 * frame only after, so wait for it instead of faulting again
+		 * until it is done. */
+		if (page->frame != NULL)
+			vm_wait_eviction ();
+
+		if (page->frame != NULL)
+			/* vmworkd brought it in while we waited. */
+			success = true;
+		else {
+			size_t page_ins = t->page_ins;
+
+			success = vm_do_claim_page (page);
+			if (success) {
+				major = t->page_ins != page_ins;
+				vm_readahead (spt, page);
+			}
+		}
+	}
+	lock_release (&spt->lock);
+
+	if (success) {
+		if (major)
+			t->rusage.major_faults++;
+		else
+			t->rusage.minor_faults++;
+	}
+	return success;
+}
+
+/* Brings PAGE in if needed and pins its frame, so that it is neither
+ * evicted nor merged until unpinned.  If WRITE, first gives PAGE a
+ * private copy of a merged frame, so that the kernel's stores do not
+ * move it to another frame.  Must be called with the SPT lock held. */
+static bool
+pin_page (struct page *page, bool write) {
+	struct thread *t = thread_current ();
+
+	for (;;) {
+		struct frame *frame;
+		bool pinned = false, cow = false;
+
+		if (page->frame == NULL) {
+			size_t page_ins = t->page_ins;
+
+			if (!vm_do_claim_page (page))
+				return false;
+			if (t->page_ins != page_ins)
+				t->rusage.major_faults++;
+			else
+				t->rusage.minor_faults++;
+		}
+
+		lock_acquire (&frame_lock);
+		frame = page->frame;
+		if (frame != NULL) {
+			if (write && frame->ksm != NULL)
+				cow = true;
+			else if (frame->page == page || frame->share != NULL
+					|| frame->ksm != NULL) {
+				frame->pin_cnt++;
+				pinned = true;
+			}
+		}
+		lock_release (&frame_lock);
+
+		if (pinned)
+			return true;
+		if (cow)
+			ksm_handle_wp (page);
+		else if (frame != NULL)
+			/* ksmd is looking at the page. */
+			ksm_wait ();
+	}
+}
+
+/* Unpins the frame of PAGE, which was pinned by pin_page(). */
+static void
+unpin_page (struct page *page) {
+	lock_acquire (&frame_lock);
+	ASSERT (page->frame != NULL && page->frame->pin_cnt > 0);
+	page->frame->pin_cnt--;
+	lock_release (&frame_lock);
+}
+
+/* Brings in and pins every page of the SIZE bytes of the current
+ * process's memory at ADDR, growing the stack if needed, so that a
+ * system call can copy to or from them without faulting.  WRITE is
+ * true if the kernel will store into them.  Returns false, with
+ * nothing pinned, if part of the range is not mapped or, for WRITE,
+ * not writable.  Unpin with vm_unpin_pages(). */
+bool
+vm_pin_pages (const void *addr, size_t size, bool write) {
+	struct thread *t = thread_current ();
+	struct supplemental_page_table *spt = &t->spt;
+	uint8_t *start = pg_round_down (addr);
+	uint8_t *end = (uint8_t *) addr + size;
+	uint8_t *va;
+
+	if (size == 0)
+		return true;
+	if (end < start || !is_user_vaddr (end - 1))
+		return false;
+
+	lock_acquire (&spt->lock);
+	for (va = start; va < end; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+		void *probe = va > (uint8_t *) addr ? va : (uint8_t *) addr;
+
+		if (page == NULL && is_stack_access (probe, t->user_rsp)) {
+			vm_stack_growth (va);
+			page = spt_find_page (spt, va);
+		}
+		if (page == NULL || (write && !page->writable)
+				|| !pin_page (page, write))
+			break;
+	}
+	if (va < end) {
+		while (va > start) {
+			va -= PGSIZE;
+			unpin_page (spt_find_page (spt, va));
+		}
+		lock_release (&spt->lock);
+		return false;
+	}
+	lock_release (&spt->lock);
+	return true;
+}
+
+/* Unpins the pages pinned by vm_pin_pages (ADDR, SIZE, ...). */
+void
+vm_unpin_pages (const void *addr, size_t size) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *end = (uint8_t *) addr + size;
+
+	if (size == 0)
+		return;
+	lock_acquire (&spt->lock);
+	for (uint8_t *va = pg_round_down (addr); va < end; va += PGSIZE)
+		unpin_page (spt_find_page (spt, va));
+	lock_release (&spt->lock);
+}
+
+/* Fills in the memory fields of USAGE for the current process: its
+ * resident pages by kind, and its anonymous pages in swap.  Shared
+ * frames count once for each process mapping them. */
+void
+vm_get_rusage (struct rusage *usage) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct hash_iterator i;
+
+	usage->anon_pages = usage->file_pages = usage->swap_pages = 0;
+	lock_acquire (&spt->lock);
+	hash_first (&i, &spt->pages);
+	while (hash_next (&i)) {
+		struct page *page = hash_entry (hash_cur (&i), struct page, spt_elem);
+		enum vm_type type = VM_TYPE (page->operations->type);
+
+		if (page->frame != NULL) {
+			if (type == VM_ANON)
+				usage->anon_pages++;
+			else if (type == VM_FILE)
+				usage->file_pages++;
+		} else if (type == VM_ANON && anon_is_swapped (page))
+			usage->swap_pages++;
+	}
+	lock_release (&spt->lock);
 }
 
 /* Free the page.
@@ -150,9 +880,10 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
+	if (page == NULL)
+		return false;
 
 	return vm_do_claim_page (page);
 }
@@ -160,31 +891,353 @@ vm_claim_page (void *va UNUSED) {
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	if (page->operations->type & VM_SHARED)
+		return share_claim_page (page);
+
+	struct frame *frame = get_frame (page->owner);
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	vm_rmap_add (frame, page);
+
+	if (!swap_in (page, frame->kva)
+			|| !pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		vm_rmap_remove (page);
+		vm_free_frame (frame);
+		return false;
+	}
+
+	/* Only now may the frame be chosen as a victim. */
+	lock_acquire (&frame_lock);
+	frame_set_page (frame, page);
+	lock_release (&frame_lock);
+	return true;
+}
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+/* Queues the PAGE_CNT pages of the current process at ADDR for
+ * vmworkd, which calls FUNC on each of them, or on a null pointer for
+ * one that is not in the table.  Must be called with the SPT lock
+ * held.  Returns false if out of memory. */
+bool
+vm_queue_work (void *addr, size_t page_cnt, vm_work_func *func) {
+	struct thread *t = thread_current ();
+	struct vm_work *work = malloc (sizeof *work);
+
+	ASSERT (lock_held_by_current_thread (&t->spt.lock));
 
-	return swap_in (page, frame->kva);
+	if (work == NULL)
+		return false;
+	work->owner = t;
+	work->addr = addr;
+	work->page_cnt = page_cnt;
+	work->func = func;
+	t->spt.worker_cnt++;
+
+	lock_acquire (&work_lock);
+	list_push_back (&work_queue, &work->elem);
+	lock_release (&work_lock);
+	sema_up (&work_sema);
+	return true;
+}
+
+/* Works on the ranges of pages queued by vm_queue_work(), in order.
+ * Takes the owner's SPT lock for one page at a time, so its faults are
+ * not held up for long. */
+static void
+vmworkd (void *aux UNUSED) {
+	for (;;) {
+		struct vm_work *work;
+		struct supplemental_page_table *spt;
+
+		sema_down (&work_sema);
+		lock_acquire (&work_lock);
+		work = list_entry (list_pop_front (&work_queue), struct vm_work, elem);
+		lock_release (&work_lock);
+
+		spt = &work->owner->spt;
+		for (size_t i = 0; i < work->page_cnt; i++) {
+			lock_acquire (&spt->lock);
+			work->func (spt_find_page (spt, work->addr + i * PGSIZE));
+			lock_release (&spt->lock);
+		}
+
+		/* The owner waits for its work to be done before it exits. */
+		lock_acquire (&spt->lock);
+		spt->worker_cnt--;
+		cond_signal (&spt->worker_done, &spt->lock);
+		lock_release (&spt->lock);
+		free (work);
+	}
+}
+
+/* Brings in PAGE for MADV_WILLNEED, unless it is already in. */
+static void
+prefetch_page (struct page *page) {
+	if (page != NULL && page->frame == NULL)
+		vm_do_claim_page (page);
+}
+
+/* Drops PAGE's contents for MADV_DONTNEED.  Anonymous pages are thrown
+ * away without being swapped out, and made again as they were
+ * allocated, so that when next touched a data segment page reads back
+ * from the executable and any other one, the stack included, as zeros.
+ * File-backed pages are written back if dirty and read again when next
+ * touched.  Must be called with the SPT lock held. */
+static void
+drop_page (struct supplemental_page_table *spt, struct page *page) {
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_ANON: {
+			struct anon_page *anon = &page->anon;
+			void *va = page->va;
+			bool writable = page->writable;
+			enum vm_type type = anon->type;
+			vm_initializer *init = anon->init;
+			void *aux = anon->aux;
+
+			/* The new page takes over the initializer's argument. */
+			anon->aux = NULL;
+			spt_remove_page (spt, page);
+			if (!vm_alloc_page_with_initializer (type, va, writable, init,
+						aux))
+				free (aux);
+			break;
+		}
+		case VM_FILE:
+			destroy (page);
+			break;
+		default:
+			/* Not brought in yet. */
+			break;
+	}
+}
+
+/* Applies ADVICE, one of the MADV_* values, to the LENGTH bytes of the
+ * current process's memory at page-aligned ADDR.  Returns 0 if
+ * successful, -1 otherwise. */
+int
+vm_madvise (void *addr, size_t length, int advice) {
+	struct thread *t = thread_current ();
+	struct supplemental_page_table *spt = &t->spt;
+	size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	uint8_t *start = addr, *end = start + page_cnt * PGSIZE;
+	int result = 0;
+
+	lock_acquire (&spt->lock);
+	switch (advice) {
+		case MADV_NORMAL:
+		case MADV_RANDOM:
+		case MADV_SEQUENTIAL:
+			/* Only mmap() regions change behavior.  MADV_RANDOM is the
+			 * same as MADV_NORMAL, since no readahead is done by default. */
+			for (struct list_elem *e = list_begin (&t->mmap_list);
+					e != list_end (&t->mmap_list); e = list_next (e)) {
+				struct mmap_region *region = list_entry (e,
+						struct mmap_region, elem);
+				uint8_t *region_start = region->addr;
+				uint8_t *region_end = region_start + region->page_cnt * PGSIZE;
+
+				if (region_start < end && start < region_end)
+					region->advice = advice;
+			}
+			break;
+
+		case MADV_WILLNEED:
+			if (!vm_queue_work (start, page_cnt, prefetch_page))
+				result = -1;
+			break;
+
+		case MADV_DONTNEED:
+			for (uint8_t *va = start; va < end; va += PGSIZE) {
+				struct page *page = spt_find_page (spt, va);
+				if (page != NULL)
+					drop_page (spt, page);
+			}
+			pml4_free_tables (t->pml4, start, end);
+			break;
+
+		default:
+			result = -1;
+			break;
+	}
+	lock_release (&spt->lock);
+	return result;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	hash_init (&spt->pages, page_hash, page_less, NULL);
+	lock_init (&spt->lock);
+	spt->worker_cnt = 0;
+	cond_init (&spt->worker_done);
+}
+
+/* Makes DST, a page newly created in the current process, hold the
+ * same contents as SRC.  Both are brought in first; frame_lock keeps
+ * either from being evicted while the bytes are copied. */
+static bool
+copy_page_contents (struct page *dst, struct page *src) {
+	for (;;) {
+		if (src->frame == NULL && !vm_do_claim_page (src))
+			return false;
+		if (dst->frame == NULL && !vm_do_claim_page (dst))
+			return false;
+
+		lock_acquire (&frame_lock);
+		if (src->frame != NULL && dst->frame != NULL) {
+			memcpy (dst->frame->kva, src->frame->kva, PGSIZE);
+			if (pml4_is_dirty (src->owner->pml4, src->va))
+				pml4_set_dirty (dst->owner->pml4, dst->va, true);
+			lock_release (&frame_lock);
+			return true;
+		}
+		lock_release (&frame_lock);
+	}
+}
+
+/* Duplicates the lazy load argument AUX of an uninit segment page for
+ * the current process, which has its own handle of the executable. */
+static struct lazy_load_arg *
+copy_lazy_load_arg (const struct lazy_load_arg *aux) {
+	struct lazy_load_arg *copy = malloc (sizeof *copy);
+	if (copy == NULL)
+		return NULL;
+
+	*copy = *aux;
+	copy->file = thread_current ()->running;
+	return copy;
+}
+
+/* Adds a copy of SRC_PAGE, a page of the parent process, to DST, the
+ * current process's table.  Shared pages, text and mmap() alike, keep
+ * mapping the parent's frames. */
+static bool
+copy_page (struct supplemental_page_table *dst, struct page *src_page) {
+	struct page *dst_page;
+
+	if (src_page->operations->type & VM_SHARED) {
+		struct file_page *file_page = &src_page->file;
+		struct mmap_region *region = NULL;
+		struct file *file = thread_current ()->running;
+
+		if (file_page->region != NULL) {
+			region = mmap_inherit_region (file_page->region);
+			if (region == NULL)
+				return false;
+			file = region->file;
+		}
+		return share_alloc_page (src_page->va, file, file_page->ofs,
+				file_page->read_bytes, src_page->writable, region);
+	}
+
+	if (VM_TYPE (src_page->operations->type) == VM_UNINIT) {
+		struct uninit_page *uninit = &src_page->uninit;
+		void *aux = NULL;
+
+		if (uninit->aux != NULL) {
+			aux = copy_lazy_load_arg (uninit->aux);
+			if (aux == NULL)
+				return false;
+		}
+		if (!vm_alloc_page_with_initializer (uninit->type, src_page->va,
+					src_page->writable, uninit->init, aux)) {
+			free (aux);
+			return false;
+		}
+		return true;
+	}
+
+	/* A resident anonymous page: copy its contents, and what fills it
+	 * again after MADV_DONTNEED. */
+	if (!vm_alloc_page (src_page->anon.type, src_page->va,
+				src_page->writable))
+		return false;
+
+	dst_page = spt_find_page (dst, src_page->va);
+	if (!copy_page_contents (dst_page, src_page))
+		return false;
+	if (src_page->anon.aux != NULL) {
+		dst_page->anon.aux = copy_lazy_load_arg (src_page->anon.aux);
+		if (dst_page->anon.aux == NULL)
+			return false;
+		dst_page->anon.init = src_page->anon.init;
+	}
+	return true;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct hash_iterator i;
+	bool success = true;
+
+	/* vmworkd may still be bringing the parent's pages in. */
+	lock_acquire (&src->lock);
+	hash_first (&i, &src->pages);
+	while (success && hash_next (&i))
+		success = copy_page (dst, hash_entry (hash_cur (&i), struct page,
+					spt_elem));
+	lock_release (&src->lock);
+	return success;
+}
+
+/* Unmaps PAGE from its shared frame, if it is a shared page.  The
+ * page itself stays in the table. */
+static void
+unshare_page (struct hash_elem *e, void *aux UNUSED) {
+	struct page *page = hash_entry (e, struct page, spt_elem);
+
+	if (page->operations->type & VM_SHARED)
+		destroy (page);
+}
+
+/* Releases what other processes can observe of the current process's
+ * table SPT: its mmap() regions are unmapped, which writes their dirty
+ * pages back to their files, and its shared text pages are unmapped,
+ * which lets the executable be written once no one else runs it.  What
+ * is left is private to the process and can be freed later, possibly
+ * by another thread, with supplemental_page_table_kill(). */
+void
+supplemental_page_table_unshare (struct supplemental_page_table *spt) {
+	struct list *mmap_list = &thread_current ()->mmap_list;
+
+	lock_acquire (&spt->lock);
+	while (spt->worker_cnt > 0)
+		cond_wait (&spt->worker_done, &spt->lock);
+	lock_release (&spt->lock);
+
+	while (!list_empty (mmap_list))
+		do_munmap (list_entry (list_front (mmap_list),
+					struct mmap_region, elem)->addr);
+	hash_apply (&spt->pages, unshare_page);
 }
 
-/* Free the resource hold by the supplemental page table */
+/* Free the resource hold by the supplemental page table.
+ * supplemental_page_table_unshare() must have been called on SPT. */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	hash_clear (&spt->pages, page_destructor);
+}
+
+/* Returns a hash value for the page that E belongs to. */
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *p = hash_entry (e, struct page, spt_elem);
+	return hash_bytes (&p->va, sizeof p->va);
+}
+
+/* Orders pages by user virtual address. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	const struct page *pa = hash_entry (a, struct page, spt_elem);
+	const struct page *pb = hash_entry (b, struct page, spt_elem);
+	return pa->va < pb->va;
+}
+
+/* Frees the page that E belongs to. */
+static void
+page_destructor (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
 }